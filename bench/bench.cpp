@@ -0,0 +1,267 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "cleaner.h"
+
+/* Synthetic 8 bit masks covering the typical and the worst cases of every engine, cleaned with
+   each engine and a few length/fade settings. Prints throughput and the scratch memory the
+   workspaces grew to. Every engine has to give the same mask as the flood fill, the bench fails
+   otherwise. */
+
+struct Size {
+    const char *name;
+    int width;
+    int height;
+};
+
+static const Size sizes[] = {
+    { "480p", 854, 480 },
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+    { "2160p", 3840, 2160 },
+    { "4320p", 7680, 4320 },
+};
+
+struct EngineSetting {
+    const char *name;
+    Engine engine;
+    /* more than one thread always takes the parallel union-find path */
+    int threads;
+};
+
+static const EngineSetting engines[] = {
+    { "flood_fill", Engine::FloodFill, 1 },
+    { "union_find", Engine::UnionFind, 1 },
+    { "runs", Engine::Runs, 1 },
+    { "auto", Engine::Auto, 1 },
+    { "parallel", Engine::UnionFind, 0 },
+};
+
+struct Setting {
+    int length;
+    int fade;
+};
+
+static const Setting settings[] = {
+    { 5, 0 },
+    { 5, 50 },
+    { 500, 0 },
+    { 500, 250 },
+    /* every component is faded */
+    { 5, 10000000 },
+};
+
+static const uint8_t white = 255;
+static const int thresh = 235;
+
+typedef void (*Generator)(std::vector<uint8_t> &mask, int width, int height, std::mt19937 &rng);
+
+/* about 1% isolated white pixels */
+static void generate_salt(std::vector<uint8_t> &mask, int, int, std::mt19937 &rng) {
+    std::uniform_int_distribution<int> percent(0, 99);
+    for (size_t i = 0; i < mask.size(); ++i) {
+        mask[i] = percent(rng) == 0 ? white : 0;
+    }
+}
+
+/* 45% white, close to the percolation threshold, so lots of mid sized components */
+static void generate_speckle(std::vector<uint8_t> &mask, int, int, std::mt19937 &rng) {
+    std::uniform_int_distribution<int> percent(0, 99);
+    for (size_t i = 0; i < mask.size(); ++i) {
+        mask[i] = percent(rng) < 45 ? white : 0;
+    }
+}
+
+/* a few hundred overlapping discs like a real detail or edge mask */
+static void generate_blobs(std::vector<uint8_t> &mask, int width, int height, std::mt19937 &rng) {
+    std::fill(mask.begin(), mask.end(), 0);
+    std::uniform_int_distribution<int> xs(0, width - 1);
+    std::uniform_int_distribution<int> ys(0, height - 1);
+    std::uniform_int_distribution<int> radii(2, std::max(3, height / 12));
+    for (int i = 0; i < 300; ++i) {
+        int cx = xs(rng);
+        int cy = ys(rng);
+        int r = radii(rng);
+        for (int y = std::max(0, cy - r); y < std::min(height, cy + r + 1); ++y) {
+            for (int x = std::max(0, cx - r); x < std::min(width, cx + r + 1); ++x) {
+                if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= r * r) {
+                    mask[size_t(y) * width + x] = white;
+                }
+            }
+        }
+    }
+}
+
+/* 1 pixel wide diagonals, only connected through corners */
+static void generate_lines(std::vector<uint8_t> &mask, int width, int height, std::mt19937 &) {
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            mask[size_t(y) * width + x] = (x + y) % 16 == 0 ? white : 0;
+        }
+    }
+}
+
+/* a single snake filling the frame, the longest possible component */
+static void generate_serpentine(std::vector<uint8_t> &mask, int width, int height, std::mt19937 &) {
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            bool on = y % 2 == 0 || (y % 4 == 1 ? x == width - 1 : x == 0);
+            mask[size_t(y) * width + x] = on ? white : 0;
+        }
+    }
+}
+
+static void generate_black(std::vector<uint8_t> &mask, int, int, std::mt19937 &) {
+    std::fill(mask.begin(), mask.end(), 0);
+}
+
+static void generate_white(std::vector<uint8_t> &mask, int, int, std::mt19937 &) {
+    std::fill(mask.begin(), mask.end(), white);
+}
+
+struct Pattern {
+    const char *name;
+    Generator generate;
+};
+
+static const Pattern patterns[] = {
+    { "salt", generate_salt },
+    { "speckle", generate_speckle },
+    { "blobs", generate_blobs },
+    { "lines", generate_lines },
+    { "serpentine", generate_serpentine },
+    { "black", generate_black },
+    { "white", generate_white },
+};
+
+/* comma separated list filter, an empty one selects everything */
+static bool selected(const std::string &list, const char *name) {
+    if (list.empty()) {
+        return true;
+    }
+    std::string padded = "," + list + ",";
+    return padded.find("," + std::string(name) + ",") != std::string::npos;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: tmaskcleaner_bench [options]\n"
+        "  --sizes LIST      480p,720p,1080p,2160p,4320p\n"
+        "  --patterns LIST   salt,speckle,blobs,lines,serpentine,black,white\n"
+        "  --engines LIST    flood_fill,union_find,runs,auto,parallel\n"
+        "  --connectivity N  4 or 8 (default)\n"
+        "  --threads N       threads of the parallel engine, 0 for all cores (default)\n"
+        "  --time SECONDS    minimum time spent on each case (default 0.5)\n"
+        "  --cpu N           kernels to use: 0 C, 1 SSE2, 3 AVX2 (default detected)\n");
+}
+
+int main(int argc, char **argv) {
+    std::string size_list, pattern_list, engine_list;
+    int threads = 0;
+    int connectivity = 8;
+    double min_time = 0.5;
+    int cpu = cpu_features();
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (!strcmp(arg, "--sizes")) {
+            size_list = value;
+        } else if (!strcmp(arg, "--patterns")) {
+            pattern_list = value;
+        } else if (!strcmp(arg, "--engines")) {
+            engine_list = value;
+        } else if (!strcmp(arg, "--connectivity")) {
+            connectivity = atoi(value);
+        } else if (!strcmp(arg, "--threads")) {
+            threads = atoi(value);
+        } else if (!strcmp(arg, "--time")) {
+            min_time = atof(value);
+        } else if (!strcmp(arg, "--cpu")) {
+            cpu = atoi(value);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    const char *error = check_parameters(5, thresh, thresh, 0, connectivity, 0, threads, 0);
+    if (error) {
+        fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+
+    int mismatches = 0;
+    printf("%-6s %-11s %-11s %6s %5s %9s %9s %11s\n", "size", "pattern", "engine", "length", "fade", "Mpix/s", "ns/pix", "scratch MiB");
+
+    for (const Size &size : sizes) {
+        if (!selected(size_list, size.name)) {
+            continue;
+        }
+        const int w = size.width;
+        const int h = size.height;
+        std::vector<uint8_t> src(size_t(w) * h);
+        std::vector<uint8_t> dst(size_t(w) * h);
+
+        for (const Pattern &pattern : patterns) {
+            if (!selected(pattern_list, pattern.name)) {
+                continue;
+            }
+            std::mt19937 rng(12345);
+            pattern.generate(src, w, h, rng);
+
+            /* the flood fill is the simplest engine, so it's the reference of the others */
+            std::vector<std::vector<uint8_t>> expected;
+            for (const Setting &setting : settings) {
+                Cleaner<uint8_t> reference(w, h, setting.length, thresh, thresh, setting.fade, connectivity, 0, 1, 8, cpu, Engine::FloodFill);
+                expected.push_back(std::vector<uint8_t>(size_t(w) * h));
+                reference.clear_mask(expected.back().data(), src.data(), w, h, w, w);
+            }
+
+            for (const EngineSetting &engine : engines) {
+                if (!selected(engine_list, engine.name)) {
+                    continue;
+                }
+                for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); ++i) {
+                    const Setting &setting = settings[i];
+                    int engine_threads = engine.threads == 1 ? 1 : threads;
+                    Cleaner<uint8_t> cleaner(w, h, setting.length, thresh, thresh, setting.fade, connectivity, 0, engine_threads, 8, cpu, engine.engine);
+
+                    /* the first call allocates the workspace and isn't timed */
+                    cleaner.clear_mask(dst.data(), src.data(), w, h, w, w);
+
+                    typedef std::chrono::steady_clock Clock;
+                    Clock::time_point start = Clock::now();
+                    double elapsed = 0;
+                    int iterations = 0;
+                    do {
+                        cleaner.clear_mask(dst.data(), src.data(), w, h, w, w);
+                        ++iterations;
+                        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+                    } while (elapsed < min_time);
+
+                    double pixels = double(w) * h * iterations;
+                    printf("%-6s %-11s %-11s %6d %5d %9.1f %9.3f %11.1f\n", size.name, pattern.name, engine.name, setting.length, setting.fade,
+                        pixels / elapsed / 1e6, elapsed * 1e9 / pixels, cleaner.workspace_memory() / (1024.0 * 1024.0));
+                    fflush(stdout);
+                    if (dst != expected[i]) {
+                        fprintf(stderr, "tmaskcleaner_bench: %s differs from flood_fill on %s %s, length %d, fade %d\n",
+                            engine.name, size.name, pattern.name, setting.length, setting.fade);
+                        ++mismatches;
+                    }
+                }
+            }
+        }
+    }
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,554 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cleaner.h"
+
+/* Cleans raw planar or Y4M mask sequences without a frame server. A reader thread fills
+   recycled frame buffers, workers clean whole frames and a writer puts them back in order,
+   so reading, cleaning and writing overlap and the queues never hold more than a few frames. */
+
+/* what happens to a plane, numbered like the plugin plane modes; there is nothing to leave
+   alone in a file, so 1 writes a black plane */
+enum class PlaneMode {
+    Black = 1,
+    Copy = 2,
+    Process = 3
+};
+
+struct Format {
+    int width;
+    int height;
+    int planes;
+    /* log2 of the chroma subsampling */
+    int sub_x;
+    int sub_y;
+    int bits;
+
+    int bytes_per_sample() const {
+        return bits > 8 ? 2 : 1;
+    }
+
+    int plane_width(int plane) const {
+        return plane == 0 ? width : (width + (1 << sub_x) - 1) >> sub_x;
+    }
+
+    int plane_height(int plane) const {
+        return plane == 0 ? height : (height + (1 << sub_y) - 1) >> sub_y;
+    }
+
+    size_t plane_size(int plane) const {
+        return size_t(plane_width(plane)) * plane_height(plane) * bytes_per_sample();
+    }
+
+    size_t frame_size() const {
+        size_t size = 0;
+        for (int plane = 0; plane < planes; ++plane) {
+            size += plane_size(plane);
+        }
+        return size;
+    }
+};
+
+struct ChromaName {
+    const char *name;
+    int planes;
+    int sub_x;
+    int sub_y;
+};
+
+/* raw format names are these followed by the bit depth unless it's 8, like yuv420p10 */
+static const ChromaName raw_names[] = {
+    { "gray", 1, 0, 0 },
+    { "yuv420p", 3, 1, 1 },
+    { "yuv422p", 3, 1, 0 },
+    { "yuv444p", 3, 0, 0 },
+};
+
+/* Y4M C tags with the bit depth as a pNN suffix, or just NN for mono */
+static const ChromaName y4m_names[] = {
+    { "mono", 1, 0, 0 },
+    { "420", 3, 1, 1 },
+    { "422", 3, 1, 0 },
+    { "444", 3, 0, 0 },
+};
+
+static bool valid_bits(int bits) {
+    return bits == 8 || bits == 10 || bits == 12 || bits == 14 || bits == 16;
+}
+
+static bool parse_raw_format(const char *name, Format &format) {
+    for (const ChromaName &chroma : raw_names) {
+        size_t length = strlen(chroma.name);
+        if (!strncmp(name, chroma.name, length)) {
+            format.planes = chroma.planes;
+            format.sub_x = chroma.sub_x;
+            format.sub_y = chroma.sub_y;
+            format.bits = name[length] ? atoi(name + length) : 8;
+            return valid_bits(format.bits);
+        }
+    }
+    return false;
+}
+
+static bool parse_y4m_chroma(const std::string &tag, Format &format) {
+    /* 420jpeg, 420paldv and 420mpeg2 only differ in chroma siting */
+    std::string name = tag;
+    if (name == "420jpeg" || name == "420paldv" || name == "420mpeg2") {
+        name = "420";
+    }
+    for (const ChromaName &chroma : y4m_names) {
+        size_t length = strlen(chroma.name);
+        if (!name.compare(0, length, chroma.name)) {
+            const char *rest = name.c_str() + length;
+            if (*rest == 'p' && chroma.planes == 3) {
+                ++rest;
+            }
+            format.planes = chroma.planes;
+            format.sub_x = chroma.sub_x;
+            format.sub_y = chroma.sub_y;
+            format.bits = *rest ? atoi(rest) : 8;
+            return valid_bits(format.bits);
+        }
+    }
+    return false;
+}
+
+static std::string y4m_chroma(const Format &format) {
+    for (const ChromaName &chroma : y4m_names) {
+        if (chroma.planes == format.planes && chroma.sub_x == format.sub_x && chroma.sub_y == format.sub_y) {
+            std::string name = chroma.name;
+            if (format.bits == 8) {
+                return chroma.planes == 3 && chroma.sub_y ? "420jpeg" : name;
+            }
+            return name + (chroma.planes == 3 ? "p" : "") + std::to_string(format.bits);
+        }
+    }
+    return std::string();
+}
+
+/* the rest of a header or frame line, false at the end of the file */
+static bool read_line(FILE *file, std::string &line) {
+    line.clear();
+    int c;
+    while ((c = fgetc(file)) != EOF && c != '\n') {
+        line += char(c);
+    }
+    return c != EOF || !line.empty();
+}
+
+/* parses the stream header, everything but W, H and C is copied to the output as it is */
+static bool read_y4m_header(FILE *file, Format &format, std::string &header) {
+    std::string line;
+    if (!read_line(file, line) || line.compare(0, 10, "YUV4MPEG2 ")) {
+        return false;
+    }
+    header = line + "\n";
+    format.width = 0;
+    format.height = 0;
+    format.planes = 3;
+    format.sub_x = 1;
+    format.sub_y = 1;
+    format.bits = 8;
+    size_t begin = 10;
+    while (begin < line.size()) {
+        size_t end = line.find(' ', begin);
+        if (end == std::string::npos) {
+            end = line.size();
+        }
+        std::string token = line.substr(begin, end - begin);
+        if (token[0] == 'W') {
+            format.width = atoi(token.c_str() + 1);
+        } else if (token[0] == 'H') {
+            format.height = atoi(token.c_str() + 1);
+        } else if (token[0] == 'C' && !parse_y4m_chroma(token.substr(1), format)) {
+            return false;
+        }
+        begin = end + 1;
+    }
+    return format.width > 0 && format.height > 0;
+}
+
+struct Frame {
+    int64_t index;
+    std::vector<uint8_t> src;
+    std::vector<uint8_t> dst;
+};
+
+/* blocking queue of at most capacity items; pop fails once it's closed and drained */
+template <typename Item>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity), closed_(false) {}
+
+    void push(const Item &item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return items_.size() < capacity_; });
+        items_.push_back(item);
+        not_empty_.notify_one();
+    }
+
+    bool pop(Item &item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        item = items_.front();
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    bool closed_;
+    std::deque<Item> items_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+struct Options {
+    int length;
+    int thresh;
+    int thresh_high;
+    int fade;
+    int connectivity;
+    int threads;
+    int cpu;
+    Engine engine;
+    int expand;
+    ExpandShape expand_shape;
+    std::string planes;
+};
+
+struct Stream {
+    FILE *file;
+    bool y4m;
+};
+
+/* reads frames until the end of the input, false on a truncated or malformed frame */
+static bool read_frame(const Stream &input, Frame &frame) {
+    if (input.y4m) {
+        std::string line;
+        if (!read_line(input.file, line)) {
+            frame.src.clear();
+            return true;
+        }
+        if (line.compare(0, 5, "FRAME")) {
+            return false;
+        }
+    }
+    size_t read = fread(frame.src.data(), 1, frame.src.size(), input.file);
+    if (read == 0 && !input.y4m) {
+        frame.src.clear();
+        return true;
+    }
+    return read == frame.src.size();
+}
+
+template <typename T>
+static void clean_frame(Cleaner<T> &cleaner, const Format &format, const Options &options, Frame &frame) {
+    size_t offset = 0;
+    for (int plane = 0; plane < format.planes; ++plane) {
+        int width = format.plane_width(plane);
+        int height = format.plane_height(plane);
+        int pitch = width * int(sizeof(T));
+        char mode = size_t(plane) < options.planes.size() ? options.planes[plane] : '1';
+        uint8_t *dst = frame.dst.data() + offset;
+        const uint8_t *src = frame.src.data() + offset;
+        switch (PlaneMode(mode - '0')) {
+        case PlaneMode::Process:
+            cleaner.clear_mask(dst, src, width, height, pitch, pitch);
+            break;
+        case PlaneMode::Copy:
+            memcpy(dst, src, format.plane_size(plane));
+            break;
+        case PlaneMode::Black:
+            memset(dst, 0, format.plane_size(plane));
+            break;
+        }
+        offset += format.plane_size(plane);
+    }
+}
+
+template <typename T>
+static int run(const Stream &input, const Stream &output, const Format &format, const Options &options) {
+    Cleaner<T> cleaner(format.width, format.height, options.length, options.thresh, options.thresh_high, options.fade,
+        options.connectivity, 0, 1, format.bits, options.cpu, options.engine,
+        options.expand, options.expand_shape);
+    const int workers = options.threads;
+    const size_t frame_count = size_t(workers) * 2 + 2;
+
+    /* buffers cycle from free to the workers to the writer and back, so nothing is allocated per frame */
+    std::vector<Frame> frames(frame_count);
+    BoundedQueue<Frame*> free_frames(frame_count);
+    BoundedQueue<Frame*> to_clean(frame_count);
+    BoundedQueue<Frame*> cleaned(frame_count);
+    for (size_t i = 0; i < frame_count; ++i) {
+        frames[i].src.resize(format.frame_size());
+        frames[i].dst.resize(format.frame_size());
+        free_frames.push(&frames[i]);
+    }
+
+    std::atomic<bool> read_error(false);
+    std::atomic<bool> write_error(false);
+    int64_t written = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::thread reader([&] {
+        for (int64_t index = 0; !write_error; ++index) {
+            Frame *frame = nullptr;
+            if (!free_frames.pop(frame)) {
+                break;
+            }
+            frame->src.resize(format.frame_size());
+            if (!read_frame(input, *frame)) {
+                read_error = true;
+                break;
+            }
+            if (frame->src.empty()) {
+                break;
+            }
+            frame->index = index;
+            to_clean.push(frame);
+        }
+        to_clean.close();
+    });
+
+    std::vector<std::thread> cleaners;
+    for (int i = 0; i < workers; ++i) {
+        cleaners.push_back(std::thread([&] {
+            Frame *frame;
+            while (to_clean.pop(frame)) {
+                clean_frame(cleaner, format, options, *frame);
+                cleaned.push(frame);
+            }
+        }));
+    }
+
+    /* the writer runs on this thread and holds frames that finished early until it's their turn */
+    std::thread closer([&] {
+        for (auto &thread : cleaners) {
+            thread.join();
+        }
+        cleaned.close();
+    });
+    std::map<int64_t, Frame*> pending;
+    Frame *frame;
+    while (cleaned.pop(frame)) {
+        pending[frame->index] = frame;
+        for (auto it = pending.find(written); it != pending.end(); it = pending.find(written)) {
+            if (!write_error) {
+                if (output.y4m) {
+                    fputs("FRAME\n", output.file);
+                }
+                write_error = fwrite(it->second->dst.data(), 1, it->second->dst.size(), output.file) != it->second->dst.size();
+                /* nothing more is written, so the reader stops once it runs out of buffers */
+                if (write_error) {
+                    free_frames.close();
+                }
+            }
+            if (!write_error) {
+                free_frames.push(it->second);
+            }
+            pending.erase(it);
+            ++written;
+        }
+    }
+    closer.join();
+    reader.join();
+    /* the engine is only worth mentioning when it was chosen on the fly */
+    if (options.engine == Engine::Auto) {
+        fprintf(stderr, "engine %s\n", engine_name(cleaner.engine()));
+    }
+    if (fflush(output.file)) {
+        write_error = true;
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "%lld frames in %.2f s, %.2f fps, %.1f MB/s\n", (long long)written, elapsed,
+        elapsed > 0 ? written / elapsed : 0.0, elapsed > 0 ? written * double(format.frame_size()) / elapsed / 1e6 : 0.0);
+    if (read_error) {
+        fprintf(stderr, "tmaskcleaner_cli: truncated or malformed input frame.\n");
+    }
+    if (write_error) {
+        fprintf(stderr, "tmaskcleaner_cli: can't write the output.\n");
+    }
+    return read_error || write_error ? 1 : 0;
+}
+
+static bool ends_with(const std::string &s, const char *suffix) {
+    size_t length = strlen(suffix);
+    return s.size() >= length && !s.compare(s.size() - length, length, suffix);
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: tmaskcleaner_cli [options] INPUT OUTPUT\n"
+        "  INPUT and OUTPUT are files or - for stdin/stdout; .y4m files are Y4M, everything else raw planar\n"
+        "  --size WxH          frame size of raw input\n"
+        "  --format NAME       format of raw input: gray, yuv420p, yuv422p or yuv444p,\n"
+        "                      followed by 10, 12, 14 or 16 for high bit depths (default gray)\n"
+        "  --y4m               read stdin or write stdout as Y4M\n"
+        "  --length N          (default 5)\n"
+        "  --thresh N          (default 235)\n"
+        "  --thresh-high N     (default thresh)\n"
+        "  --fade N            (default 0)\n"
+        "  --connectivity N    4 or 8 (default)\n"
+        "  --planes MODES      1 black, 2 copy, 3 clean per plane (default 311)\n"
+        "  --expand N          grow what's kept by N pixels (default 0)\n"
+        "  --expand-shape NAME square (default) or diamond\n"
+        "  --engine NAME       auto, floodfill, unionfind (default) or runs\n"
+        "  --threads N         cleaning threads, 0 for all cores (default)\n"
+        "  --cpu N             kernels to use: 0 C, 1 SSE2, 3 AVX2 (default detected)\n");
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    options.length = 5;
+    options.thresh = 235;
+    options.thresh_high = -1;
+    options.fade = 0;
+    options.connectivity = 8;
+    options.threads = 0;
+    options.cpu = cpu_features();
+    options.engine = Engine::UnionFind;
+    options.expand = 0;
+    options.expand_shape = ExpandShape::Square;
+    options.planes = "311";
+    Format format = Format();
+    bool raw_size = false;
+    bool stdio_y4m = false;
+    std::string raw_format = "gray";
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (arg[0] != '-' || !arg[1]) {
+            files.push_back(arg);
+            continue;
+        }
+        if (!strcmp(arg, "--y4m")) {
+            stdio_y4m = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (!strcmp(arg, "--size")) {
+            raw_size = sscanf(value, "%dx%d", &format.width, &format.height) == 2;
+        } else if (!strcmp(arg, "--format")) {
+            raw_format = value;
+        } else if (!strcmp(arg, "--length")) {
+            options.length = atoi(value);
+        } else if (!strcmp(arg, "--thresh")) {
+            options.thresh = atoi(value);
+        } else if (!strcmp(arg, "--thresh-high")) {
+            options.thresh_high = atoi(value);
+        } else if (!strcmp(arg, "--fade")) {
+            options.fade = atoi(value);
+        } else if (!strcmp(arg, "--connectivity")) {
+            options.connectivity = atoi(value);
+        } else if (!strcmp(arg, "--planes")) {
+            options.planes = value;
+        } else if (!strcmp(arg, "--expand")) {
+            options.expand = atoi(value);
+        } else if (!strcmp(arg, "--expand-shape")) {
+            if (!parse_expand_shape(value, options.expand_shape)) {
+                fprintf(stderr, "tmaskcleaner_cli: expand shape must be square or diamond.\n");
+                return 1;
+            }
+        } else if (!strcmp(arg, "--engine")) {
+            if (!parse_engine(value, options.engine)) {
+                fprintf(stderr, "tmaskcleaner_cli: engine must be auto, floodfill, unionfind or runs.\n");
+                return 1;
+            }
+        } else if (!strcmp(arg, "--threads")) {
+            options.threads = atoi(value);
+        } else if (!strcmp(arg, "--cpu")) {
+            options.cpu = atoi(value);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (files.size() != 2) {
+        usage();
+        return 1;
+    }
+    if (options.thresh_high < 0) {
+        options.thresh_high = options.thresh;
+    }
+    const char *error = check_parameters(options.length, options.thresh, options.thresh_high, options.fade, options.connectivity, 0, options.threads, options.expand);
+    if (error) {
+        fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+    if (options.planes.size() > 3 || options.planes.find_first_not_of("123") != std::string::npos) {
+        fprintf(stderr, "tmaskcleaner_cli: planes must consist of 1 (black), 2 (copy) and 3 (clean).\n");
+        return 1;
+    }
+    if (options.threads == 0) {
+        options.threads = std::max(1, int(std::thread::hardware_concurrency()));
+    }
+
+    Stream input = { files[0] == "-" ? stdin : fopen(files[0].c_str(), "rb"), files[0] == "-" ? stdio_y4m : ends_with(files[0], ".y4m") };
+    if (!input.file) {
+        fprintf(stderr, "tmaskcleaner_cli: can't open %s.\n", files[0].c_str());
+        return 1;
+    }
+    Stream output = { files[1] == "-" ? stdout : fopen(files[1].c_str(), "wb"), files[1] == "-" ? stdio_y4m : ends_with(files[1], ".y4m") };
+    if (!output.file) {
+        fprintf(stderr, "tmaskcleaner_cli: can't create %s.\n", files[1].c_str());
+        return 1;
+    }
+    /* large stdio buffers keep the reader and writer at disk speed */
+    setvbuf(input.file, nullptr, _IOFBF, 1 << 22);
+    setvbuf(output.file, nullptr, _IOFBF, 1 << 22);
+
+    std::string header;
+    if (input.y4m) {
+        if (!read_y4m_header(input.file, format, header)) {
+            fprintf(stderr, "tmaskcleaner_cli: unsupported or malformed Y4M header.\n");
+            return 1;
+        }
+    } else if (!raw_size || format.width <= 0 || format.height <= 0 || !parse_raw_format(raw_format.c_str(), format)) {
+        fprintf(stderr, "tmaskcleaner_cli: raw input needs --size WxH and a valid --format.\n");
+        return 1;
+    }
+    if (output.y4m) {
+        if (header.empty()) {
+            header = "YUV4MPEG2 W" + std::to_string(format.width) + " H" + std::to_string(format.height) + " F25:1 Ip A1:1 C" + y4m_chroma(format) + "\n";
+        }
+        fputs(header.c_str(), output.file);
+    }
+
+    int result = format.bits == 8 ? run<uint8_t>(input, output, format, options) : run<uint16_t>(input, output, format, options);
+    if (input.file != stdin) {
+        fclose(input.file);
+    }
+    if (output.file != stdout && fclose(output.file)) {
+        result = 1;
+    }
+    return result;
+}
@@ -0,0 +1,345 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "cleaner.h"
+#include "hash.h"
+
+/* Compares the cleaner with a naive flood fill of the original algorithm: every engine, the
+   parallel and the temporal labeling, hysteresis, fading and expand, for 8, 10, 16 bit and float
+   planes at every instruction set level the cpu has. The SSE2 hash has to match the C one.
+   Prints the cases that differ and fails if there are any. */
+
+static const int cpu_levels[] = { 0, cpu_sse2, cpu_sse2 | cpu_avx2 };
+
+struct Size {
+    int width;
+    int height;
+};
+
+/* taller than two stripes, so the thread pool splits the plane */
+static const Size sizes[] = {
+    { 1, 1 },
+    { 7, 3 },
+    { 37, 23 },
+    { 64, 64 },
+    { 129, 67 },
+    { 150, 260 },
+};
+
+struct EngineSetting {
+    const char *name;
+    Engine engine;
+    int threads;
+};
+
+static const EngineSetting engines[] = {
+    { "floodfill", Engine::FloodFill, 1 },
+    { "unionfind", Engine::UnionFind, 1 },
+    { "runs", Engine::Runs, 1 },
+    { "parallel", Engine::UnionFind, 3 },
+};
+
+/* thresholds are on the 8 bit scale like the parameters; 256 is above every integer sample */
+struct Setting {
+    int length;
+    int thresh;
+    int thresh_high;
+    int fade;
+};
+
+static const Setting settings[] = {
+    { 1, 128, 128, 0 },
+    { 5, 128, 128, 3 },
+    { 40, 128, 128, 100 },
+    { 5, 128, 200, 0 },
+    { 40, 100, 220, 60 },
+    { 5, 128, 256, 0 },
+    { 2, 255, 255, 0 },
+    { 1, 256, 256, 0 },
+};
+
+struct ExpandSetting {
+    int radius;
+    ExpandShape shape;
+};
+
+static const ExpandSetting expands[] = {
+    { 0, ExpandShape::Square },
+    { 1, ExpandShape::Square },
+    { 3, ExpandShape::Square },
+    { 2, ExpandShape::Diamond },
+};
+
+static int failures = 0;
+
+/* a plane with a padded pitch in bytes */
+template <typename T>
+struct Plane {
+    int width;
+    int height;
+    int pitch;
+    std::vector<uint8_t> data;
+
+    Plane(int width, int height) : width(width), height(height), pitch((width * int(sizeof(T)) + 31) & ~31), data(size_t(pitch) * height, 0x55) {}
+
+    T &at(int x, int y) {
+        return reinterpret_cast<T *>(data.data() + size_t(pitch) * y)[x];
+    }
+
+    T at(int x, int y) const {
+        return reinterpret_cast<const T *>(data.data() + size_t(pitch) * y)[x];
+    }
+};
+
+static double sample_max(int bits) {
+    return bits == 32 ? 1.0 : double((1 << bits) - 1);
+}
+
+/* what the cleaner compares samples with, as scale_thresh does */
+static double scaled_thresh(int thresh, int bits) {
+    return bits == 32 ? double(float(thresh / 255.0)) : double(uint64_t(thresh) << (bits - 8));
+}
+
+/* white pixels spread over the upper half of the range, some of them at the maximum */
+template <typename T>
+static Plane<T> random_plane(int width, int height, int bits, double density, std::mt19937 &rng) {
+    Plane<T> plane(width, height);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    const double max = sample_max(bits);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            double value;
+            if (uniform(rng) >= density) {
+                value = max * 0.45 * uniform(rng);
+            } else if (uniform(rng) < 0.1) {
+                value = max;
+            } else {
+                value = max * (0.5 + 0.5 * uniform(rng));
+            }
+            plane.at(x, y) = T(value);
+        }
+    }
+    return plane;
+}
+
+template <typename T>
+static T fade_sample(T value, size_t numerator, unsigned int fade) {
+    if (std::is_floating_point<T>::value) {
+        return T(value * (float(numerator) / fade));
+    }
+    return T(uint64_t(value) * numerator / fade);
+}
+
+/* The original algorithm: components of pixels >= thresh with at least length pixels are kept,
+   those within fade pixels of length are scaled down. A component also needs a pixel >=
+   thresh_high and a white pixel in every neighbouring frame. */
+template <typename T>
+static std::vector<T> reference(const Plane<T> &src, const Plane<T> *const *neighbours, int neighbour_count, size_t length,
+                                double thresh, double thresh_high, unsigned int fade, int connectivity) {
+    const int w = src.width;
+    const int h = src.height;
+    std::vector<T> dst(size_t(w) * h, T(0));
+    std::vector<char> visited(size_t(w) * h, 0);
+    std::vector<std::pair<int, int> > stack;
+    std::vector<std::pair<int, int> > pixels;
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            if (visited[size_t(y) * w + x] || !(src.at(x, y) >= thresh)) {
+                continue;
+            }
+            stack.assign(1, std::make_pair(x, y));
+            pixels.assign(1, std::make_pair(x, y));
+            visited[size_t(y) * w + x] = 1;
+            while (!stack.empty()) {
+                std::pair<int, int> pixel = stack.back();
+                stack.pop_back();
+                for (int j = pixel.second - 1; j <= pixel.second + 1; ++j) {
+                    for (int i = pixel.first - 1; i <= pixel.first + 1; ++i) {
+                        if (i < 0 || j < 0 || i >= w || j >= h || (connectivity == 4 && i != pixel.first && j != pixel.second)) {
+                            continue;
+                        }
+                        if (!visited[size_t(j) * w + i] && src.at(i, j) >= thresh) {
+                            visited[size_t(j) * w + i] = 1;
+                            stack.push_back(std::make_pair(i, j));
+                            pixels.push_back(std::make_pair(i, j));
+                        }
+                    }
+                }
+            }
+            bool kept = pixels.size() >= length;
+            bool seeded = false;
+            for (size_t p = 0; p < pixels.size(); ++p) {
+                seeded = seeded || src.at(pixels[p].first, pixels[p].second) >= thresh_high;
+            }
+            kept = kept && seeded;
+            for (int k = 0; k < neighbour_count; ++k) {
+                bool overlaps = false;
+                for (size_t p = 0; p < pixels.size(); ++p) {
+                    overlaps = overlaps || neighbours[k]->at(pixels[p].first, pixels[p].second) >= thresh;
+                }
+                kept = kept && overlaps;
+            }
+            if (!kept) {
+                continue;
+            }
+            size_t excess = pixels.size() - length;
+            for (size_t p = 0; p < pixels.size(); ++p) {
+                T value = src.at(pixels[p].first, pixels[p].second);
+                dst[size_t(pixels[p].second) * w + pixels[p].first] = fade == 0 || excess > fade ? value : fade_sample(value, excess, fade);
+            }
+        }
+    }
+    return dst;
+}
+
+/* maximum over the square or the diamond of the radius around every pixel */
+template <typename T>
+static void dilate(std::vector<T> &plane, int w, int h, const ExpandSetting &expand) {
+    const int r = expand.radius;
+    std::vector<T> result(plane.size());
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            T value = T(0);
+            for (int dy = -r; dy <= r; ++dy) {
+                for (int dx = -r; dx <= r; ++dx) {
+                    if (y + dy < 0 || y + dy >= h || x + dx < 0 || x + dx >= w || (expand.shape == ExpandShape::Diamond && abs(dx) + abs(dy) > r)) {
+                        continue;
+                    }
+                    value = std::max(value, plane[size_t(y + dy) * w + x + dx]);
+                }
+            }
+            result[size_t(y) * w + x] = value;
+        }
+    }
+    plane.swap(result);
+}
+
+/* first row that differs, -1 if none does */
+template <typename T>
+static int compare(const Plane<T> &dst, const std::vector<T> &expected) {
+    for (int y = 0; y < dst.height; ++y) {
+        if (memcmp(dst.data.data() + size_t(dst.pitch) * y, expected.data() + size_t(dst.width) * y, dst.width * sizeof(T))) {
+            return y;
+        }
+    }
+    return -1;
+}
+
+template <typename T>
+static void check_spatial(int bits, int cpu, std::mt19937 &rng) {
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        const int w = sizes[s].width;
+        const int h = sizes[s].height;
+        for (int connectivity = 4; connectivity <= 8; connectivity += 4) {
+            for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); ++i) {
+                const Setting &setting = settings[i];
+                const ExpandSetting &expand = expands[i % (sizeof(expands) / sizeof(expands[0]))];
+                Plane<T> src = random_plane<T>(w, h, bits, 0.5, rng);
+                std::vector<T> expected = reference<T>(src, nullptr, 0, setting.length, scaled_thresh(setting.thresh, bits),
+                    scaled_thresh(setting.thresh_high, bits), setting.fade, connectivity);
+                dilate(expected, w, h, expand);
+                for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); ++e) {
+                    Cleaner<T> cleaner(w, h, setting.length, setting.thresh, setting.thresh_high, setting.fade, connectivity, 0, engines[e].threads,
+                        bits, cpu, engines[e].engine, expand.radius, expand.shape);
+                    Plane<T> dst(w, h);
+                    cleaner.clear_mask(dst.data.data(), src.data.data(), w, h, src.pitch, dst.pitch);
+                    int row = compare(dst, expected);
+                    if (row >= 0) {
+                        ++failures;
+                        printf("FAIL %s: bits %d cpu %d %dx%d connectivity %d length %d thresh %d thresh_high %d fade %d expand %d row %d\n",
+                            engines[e].name, bits, cpu, w, h, connectivity, setting.length, setting.thresh, setting.thresh_high, setting.fade, expand.radius, row);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* frame 1 of three, the middle one overlapping both neighbours */
+template <typename T>
+static void check_temporal(int bits, int cpu, std::mt19937 &rng) {
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        const int w = sizes[s].width;
+        const int h = sizes[s].height;
+        for (int connectivity = 4; connectivity <= 8; connectivity += 4) {
+            for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); ++i) {
+                const Setting &setting = settings[i];
+                const ExpandSetting &expand = expands[i % (sizeof(expands) / sizeof(expands[0]))];
+                Plane<T> frames[3] = { random_plane<T>(w, h, bits, 0.3, rng), random_plane<T>(w, h, bits, 0.5, rng), random_plane<T>(w, h, bits, 0.3, rng) };
+                const Plane<T> *others[2] = { &frames[0], &frames[2] };
+                std::vector<T> expected = reference<T>(frames[1], others, 2, setting.length, scaled_thresh(setting.thresh, bits),
+                    scaled_thresh(setting.thresh_high, bits), setting.fade, connectivity);
+                dilate(expected, w, h, expand);
+                for (int threads = 1; threads <= 3; threads += 2) {
+                    Cleaner<T> cleaner(w, h, setting.length, setting.thresh, setting.thresh_high, setting.fade, connectivity, 1, threads,
+                        bits, cpu, Engine::UnionFind, expand.radius, expand.shape);
+                    std::shared_ptr<const ThresholdedPlane> thresholded[3];
+                    for (int k = 0; k < 3; ++k) {
+                        thresholded[k] = cleaner.threshold_plane(k, 0, frames[k].data.data(), w, h, frames[k].pitch);
+                    }
+                    const ThresholdedPlane *neighbours[2] = { thresholded[0].get(), thresholded[2].get() };
+                    Plane<T> dst(w, h);
+                    cleaner.clear_mask_temporal(dst.data.data(), frames[1].data.data(), w, h, frames[1].pitch, dst.pitch, *thresholded[1], neighbours, 2);
+                    int row = compare(dst, expected);
+                    if (row >= 0) {
+                        ++failures;
+                        printf("FAIL temporal: bits %d cpu %d threads %d %dx%d connectivity %d length %d thresh %d thresh_high %d fade %d expand %d row %d\n",
+                            bits, cpu, threads, w, h, connectivity, setting.length, setting.thresh, setting.thresh_high, setting.fade, expand.radius, row);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void check_hash(std::mt19937 &rng) {
+#ifdef TMC_X86
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (int row_size = 0; row_size <= 100; ++row_size) {
+        for (int height = 1; height <= 3; ++height) {
+            /* the start of the plane isn't aligned either */
+            const int pitch = row_size + 19;
+            std::vector<uint8_t> data(size_t(pitch) * height + 1);
+            for (size_t i = 0; i < data.size(); ++i) {
+                data[i] = uint8_t(byte(rng));
+            }
+            const uint64_t seed = uint64_t(row_size) * 0x9e3779b97f4a7c15ULL;
+            if (hash_plane_c(data.data() + 1, pitch, row_size, height, seed) != hash_plane_sse2(data.data() + 1, pitch, row_size, height, seed)) {
+                ++failures;
+                printf("FAIL hash: row size %d height %d\n", row_size, height);
+            }
+        }
+    }
+#else
+    (void)rng;
+#endif
+}
+
+int main() {
+    std::mt19937 rng(1);
+    for (size_t i = 0; i < sizeof(cpu_levels) / sizeof(cpu_levels[0]); ++i) {
+        const int cpu = cpu_levels[i];
+        if ((cpu & cpu_features()) != cpu) {
+            printf("skipping cpu %d, not supported\n", cpu);
+            continue;
+        }
+        check_spatial<uint8_t>(8, cpu, rng);
+        check_spatial<uint16_t>(10, cpu, rng);
+        check_spatial<uint16_t>(16, cpu, rng);
+        check_spatial<float>(32, cpu, rng);
+        check_temporal<uint8_t>(8, cpu, rng);
+        check_temporal<uint16_t>(16, cpu, rng);
+        check_temporal<float>(32, cpu, rng);
+        if (cpu & cpu_sse2) {
+            check_hash(rng);
+        }
+    }
+    printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,283 @@
+#include "bitmap.h"
+#ifdef TMC_X86
+#include <emmintrin.h>
+#endif
+
+template <typename T>
+void threshold_c(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, T thresh) {
+    for (int y = 0; y < height; ++y) {
+        const T *row = reinterpret_cast<const T*>(src);
+        for (int x = 0; x < width; x += 64) {
+            int count = width - x < 64 ? width - x : 64;
+            dst[x / 64] = threshold_word(row + x, count, thresh);
+        }
+        src += src_pitch;
+        dst += dst_stride;
+    }
+}
+
+template <typename T>
+void threshold_copy_c(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, T thresh) {
+    for (int y = 0; y < height; ++y) {
+        threshold_copy_row(reinterpret_cast<T*>(dst), reinterpret_cast<const T*>(src), width, thresh);
+        src += src_pitch;
+        dst += dst_pitch;
+    }
+}
+
+template <typename T>
+int scan_c(const uint8_t *src, int src_pitch, int width, int height, T thresh) {
+    int flags = 0;
+    for (int y = 0; y < height && flags != (scan_white | scan_black); ++y) {
+        const T *row = reinterpret_cast<const T*>(src);
+        uint64_t any = 0;
+        uint64_t all = ~uint64_t(0);
+        for (int x = 0; x < width; x += 64) {
+            int count = width - x < 64 ? width - x : 64;
+            uint64_t word = threshold_word(row + x, count, thresh);
+            any |= word;
+            all &= pad_word(word, count);
+        }
+        flags |= scan_flags(any, all);
+        src += src_pitch;
+    }
+    return flags;
+}
+
+template <typename T>
+void fade_c(T *dst, const T *src, int count, uint32_t multiplier, uint32_t fade) {
+    fade_row(dst, src, count, multiplier, fade);
+}
+
+template <typename T>
+void fade_divide_c(T *dst, const T *src, int count, uint32_t multiplier, uint32_t fade) {
+    uint32_t n = fade_numerator(multiplier, fade);
+    for (int x = 0; x < count; ++x) {
+        dst[x] = T(uint64_t(src[x]) * n / fade);
+    }
+}
+
+/* float multipliers are always exact */
+template <>
+void fade_divide_c<float>(float *dst, const float *src, int count, uint32_t multiplier, uint32_t fade) {
+    fade_row(dst, src, count, multiplier, fade);
+}
+
+#ifdef TMC_X86
+static inline __m128i splat_sse2(uint8_t thresh) {
+    return _mm_set1_epi8(thresh);
+}
+
+static inline __m128i splat_sse2(uint16_t thresh) {
+    return _mm_set1_epi16(thresh);
+}
+
+static inline __m128 splat_sse2(float thresh) {
+    return _mm_set1_ps(thresh);
+}
+
+static inline uint64_t threshold_word_sse2(const uint8_t *src, __m128i t) {
+    uint64_t word = 0;
+    for (int i = 0; i < 4; ++i) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 16));
+        /* unsigned v >= t is max(v, t) == v */
+        __m128i white = _mm_cmpeq_epi8(_mm_max_epu8(v, t), v);
+        word |= uint64_t(_mm_movemask_epi8(white)) << (i * 16);
+    }
+    return word;
+}
+
+static inline uint64_t threshold_word_sse2(const uint16_t *src, __m128i t) {
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t word = 0;
+    for (int i = 0; i < 4; ++i) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 16));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 16 + 8));
+        /* there is no max_epu16 before SSE4.1, unsigned v >= t is t - v saturating to zero */
+        __m128i white_lo = _mm_cmpeq_epi16(_mm_subs_epu16(t, lo), zero);
+        __m128i white_hi = _mm_cmpeq_epi16(_mm_subs_epu16(t, hi), zero);
+        word |= uint64_t(_mm_movemask_epi8(_mm_packs_epi16(white_lo, white_hi))) << (i * 16);
+    }
+    return word;
+}
+
+static inline uint64_t threshold_word_sse2(const float *src, __m128 t) {
+    uint64_t word = 0;
+    for (int i = 0; i < 16; ++i) {
+        __m128 v = _mm_loadu_ps(src + i * 4);
+        word |= uint64_t(_mm_movemask_ps(_mm_cmpge_ps(v, t))) << (i * 4);
+    }
+    return word;
+}
+
+/* copies 16 bytes of pixels, zeroing the ones below t */
+static inline void threshold_copy_sse2(uint8_t *dst, const uint8_t *src, __m128i t) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_and_si128(v, _mm_cmpeq_epi8(_mm_max_epu8(v, t), v)));
+}
+
+static inline void threshold_copy_sse2(uint16_t *dst, const uint16_t *src, __m128i t) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i white = _mm_cmpeq_epi16(_mm_subs_epu16(t, v), _mm_setzero_si128());
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_and_si128(v, white));
+}
+
+static inline void threshold_copy_sse2(float *dst, const float *src, __m128 t) {
+    __m128 v = _mm_loadu_ps(src);
+    _mm_storeu_ps(dst, _mm_and_ps(v, _mm_cmpge_ps(v, t)));
+}
+
+/* high halves of the products of 4 unsigned dwords with m */
+static inline __m128i mulhi_epu32_sse2(__m128i v, __m128i m) {
+    __m128i even = _mm_srli_epi64(_mm_mul_epu32(v, m), 32);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(v, 32), m);
+    return _mm_or_si128(even, _mm_and_si128(odd, _mm_set_epi32(-1, 0, -1, 0)));
+}
+
+/* there is no packus_epi32 before SSE4.1, but results fit 16 bits, so they are packed signed with a bias */
+static inline __m128i pack_epu32_sse2(__m128i lo, __m128i hi) {
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16(-0x8000);
+    return _mm_add_epi16(_mm_packs_epi32(_mm_sub_epi32(lo, bias32), _mm_sub_epi32(hi, bias32)), bias16);
+}
+
+/* fades 16 bytes of pixels */
+static inline void fade_sse2(uint8_t *dst, const uint8_t *src, __m128i m) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    lo = _mm_packs_epi32(mulhi_epu32_sse2(_mm_unpacklo_epi16(lo, zero), m), mulhi_epu32_sse2(_mm_unpackhi_epi16(lo, zero), m));
+    hi = _mm_packs_epi32(mulhi_epu32_sse2(_mm_unpacklo_epi16(hi, zero), m), mulhi_epu32_sse2(_mm_unpackhi_epi16(hi, zero), m));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(lo, hi));
+}
+
+static inline void fade_sse2(uint16_t *dst, const uint16_t *src, __m128i m) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i lo = mulhi_epu32_sse2(_mm_unpacklo_epi16(v, zero), m);
+    __m128i hi = mulhi_epu32_sse2(_mm_unpackhi_epi16(v, zero), m);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), pack_epu32_sse2(lo, hi));
+}
+
+static inline void fade_sse2(float *dst, const float *src, __m128 scale) {
+    _mm_storeu_ps(dst, _mm_mul_ps(_mm_loadu_ps(src), scale));
+}
+
+static inline __m128i fade_factor_sse2(uint8_t, uint32_t multiplier, uint32_t) {
+    return _mm_set1_epi32(int(multiplier));
+}
+
+static inline __m128i fade_factor_sse2(uint16_t, uint32_t multiplier, uint32_t) {
+    return _mm_set1_epi32(int(multiplier));
+}
+
+static inline __m128 fade_factor_sse2(float, uint32_t multiplier, uint32_t fade) {
+    return _mm_set1_ps(float(fade_numerator(multiplier, fade)) / fade);
+}
+
+template <typename T>
+void threshold_sse2(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, T thresh) {
+    const auto t = splat_sse2(thresh);
+    const int simd_width = width & ~63;
+
+    for (int y = 0; y < height; ++y) {
+        const T *row = reinterpret_cast<const T*>(src);
+        for (int x = 0; x < simd_width; x += 64) {
+            dst[x / 64] = threshold_word_sse2(row + x, t);
+        }
+        if (simd_width < width) {
+            dst[simd_width / 64] = threshold_word(row + simd_width, width - simd_width, thresh);
+        }
+        src += src_pitch;
+        dst += dst_stride;
+    }
+}
+
+template <typename T>
+void threshold_copy_sse2(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, T thresh) {
+    const auto t = splat_sse2(thresh);
+    const int step = 16 / sizeof(T);
+    const int simd_width = width - width % step;
+
+    for (int y = 0; y < height; ++y) {
+        const T *src_row = reinterpret_cast<const T*>(src);
+        T *dst_row = reinterpret_cast<T*>(dst);
+        for (int x = 0; x < simd_width; x += step) {
+            threshold_copy_sse2(dst_row + x, src_row + x, t);
+        }
+        threshold_copy_row(dst_row + simd_width, src_row + simd_width, width - simd_width, thresh);
+        src += src_pitch;
+        dst += dst_pitch;
+    }
+}
+
+template <typename T>
+int scan_sse2(const uint8_t *src, int src_pitch, int width, int height, T thresh) {
+    const auto t = splat_sse2(thresh);
+    const int simd_width = width & ~63;
+    int flags = 0;
+
+    for (int y = 0; y < height && flags != (scan_white | scan_black); ++y) {
+        const T *row = reinterpret_cast<const T*>(src);
+        uint64_t any = 0;
+        uint64_t all = ~uint64_t(0);
+        for (int x = 0; x < simd_width; x += 64) {
+            uint64_t word = threshold_word_sse2(row + x, t);
+            any |= word;
+            all &= word;
+        }
+        if (simd_width < width) {
+            uint64_t word = threshold_word(row + simd_width, width - simd_width, thresh);
+            any |= word;
+            all &= pad_word(word, width - simd_width);
+        }
+        flags |= scan_flags(any, all);
+        src += src_pitch;
+    }
+    return flags;
+}
+
+template <typename T>
+void fade_sse2(T *dst, const T *src, int count, uint32_t multiplier, uint32_t fade) {
+    const auto m = fade_factor_sse2(T(), multiplier, fade);
+    const int step = 16 / sizeof(T);
+    const int simd_count = count - count % step;
+
+    for (int x = 0; x < simd_count; x += step) {
+        fade_sse2(dst + x, src + x, m);
+    }
+    fade_row(dst + simd_count, src + simd_count, count - simd_count, multiplier, fade);
+}
+
+#endif
+
+template void threshold_c<uint8_t>(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, uint8_t thresh);
+template void threshold_c<uint16_t>(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, uint16_t thresh);
+template void threshold_c<float>(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, float thresh);
+template void threshold_copy_c<uint8_t>(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, uint8_t thresh);
+template void threshold_copy_c<uint16_t>(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, uint16_t thresh);
+template void threshold_copy_c<float>(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, float thresh);
+template int scan_c<uint8_t>(const uint8_t *src, int src_pitch, int width, int height, uint8_t thresh);
+template int scan_c<uint16_t>(const uint8_t *src, int src_pitch, int width, int height, uint16_t thresh);
+template int scan_c<float>(const uint8_t *src, int src_pitch, int width, int height, float thresh);
+template void fade_c<uint8_t>(uint8_t *dst, const uint8_t *src, int count, uint32_t multiplier, uint32_t fade);
+template void fade_c<uint16_t>(uint16_t *dst, const uint16_t *src, int count, uint32_t multiplier, uint32_t fade);
+template void fade_c<float>(float *dst, const float *src, int count, uint32_t multiplier, uint32_t fade);
+template void fade_divide_c<uint8_t>(uint8_t *dst, const uint8_t *src, int count, uint32_t multiplier, uint32_t fade);
+template void fade_divide_c<uint16_t>(uint16_t *dst, const uint16_t *src, int count, uint32_t multiplier, uint32_t fade);
+template void fade_divide_c<float>(float *dst, const float *src, int count, uint32_t multiplier, uint32_t fade);
+#ifdef TMC_X86
+template void threshold_copy_sse2<uint8_t>(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, uint8_t thresh);
+template void threshold_copy_sse2<uint16_t>(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, uint16_t thresh);
+template void threshold_copy_sse2<float>(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, float thresh);
+template void threshold_sse2<uint8_t>(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, uint8_t thresh);
+template void threshold_sse2<uint16_t>(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, uint16_t thresh);
+template void threshold_sse2<float>(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, float thresh);
+template int scan_sse2<uint8_t>(const uint8_t *src, int src_pitch, int width, int height, uint8_t thresh);
+template int scan_sse2<uint16_t>(const uint8_t *src, int src_pitch, int width, int height, uint16_t thresh);
+template int scan_sse2<float>(const uint8_t *src, int src_pitch, int width, int height, float thresh);
+template void fade_sse2<uint8_t>(uint8_t *dst, const uint8_t *src, int count, uint32_t multiplier, uint32_t fade);
+template void fade_sse2<uint16_t>(uint16_t *dst, const uint16_t *src, int count, uint32_t multiplier, uint32_t fade);
+template void fade_sse2<float>(float *dst, const float *src, int count, uint32_t multiplier, uint32_t fade);
+#endif
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* the SSE2 and AVX2 kernels only exist on x86 */
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define TMC_X86
+#endif
+
+/* Packed white pixel bitmap: bit x of row y lives in word y * stride + x / 64.
+   Bits past the end of a row are always zero. Sources are planes of T (uint8_t, uint16_t
+   or float) with the pitch in bytes, kernels are instantiated for each of them. */
+template <typename T>
+struct ThresholdFunction {
+    typedef void (*type)(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, T thresh);
+};
+
+template <typename T>
+void threshold_c(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, T thresh);
+template <typename T>
+void threshold_sse2(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, T thresh);
+template <typename T>
+void threshold_avx2(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, T thresh);
+
+/* writes pixels >= thresh unchanged and everything else as zero, pitches are in bytes too */
+template <typename T>
+struct ThresholdCopyFunction {
+    typedef void (*type)(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, T thresh);
+};
+
+template <typename T>
+void threshold_copy_c(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, T thresh);
+template <typename T>
+void threshold_copy_sse2(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, T thresh);
+template <typename T>
+void threshold_copy_avx2(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, T thresh);
+
+/* Tells which pixels a plane has: scan_white if any is >= thresh, scan_black if any is below.
+   Kernels stop after the first row where both were found. */
+static const int scan_white = 1;
+static const int scan_black = 2;
+
+template <typename T>
+struct ScanFunction {
+    typedef int (*type)(const uint8_t *src, int src_pitch, int width, int height, T thresh);
+};
+
+template <typename T>
+int scan_c(const uint8_t *src, int src_pitch, int width, int height, T thresh);
+template <typename T>
+int scan_sse2(const uint8_t *src, int src_pitch, int width, int height, T thresh);
+template <typename T>
+int scan_avx2(const uint8_t *src, int src_pitch, int width, int height, T thresh);
+
+/* Scales pixels of faded components by n / fade. multiplier is n / fade as 0.32 fixed point
+   rounded up, which gives exactly value * n / fade rounded down as long as value * fade < 2^32.
+   Float kernels recover n and multiply by float(n) / fade instead. dst may be src. */
+template <typename T>
+struct FadeFunction {
+    typedef void (*type)(T *dst, const T *src, int count, uint32_t multiplier, uint32_t fade);
+};
+
+template <typename T>
+void fade_c(T *dst, const T *src, int count, uint32_t multiplier, uint32_t fade);
+template <typename T>
+void fade_sse2(T *dst, const T *src, int count, uint32_t multiplier, uint32_t fade);
+template <typename T>
+void fade_avx2(T *dst, const T *src, int count, uint32_t multiplier, uint32_t fade);
+/* for integer samples with value * fade >= 2^32, divides every pixel; floats are always exact */
+template <typename T>
+void fade_divide_c(T *dst, const T *src, int count, uint32_t multiplier, uint32_t fade);
+
+static inline uint32_t fade_numerator(uint32_t multiplier, uint32_t fade) {
+    return uint32_t((uint64_t(multiplier) * fade) >> 32);
+}
+
+static inline void fade_row(uint8_t *dst, const uint8_t *src, int count, uint32_t multiplier, uint32_t) {
+    for (int x = 0; x < count; ++x) {
+        dst[x] = uint8_t((uint64_t(src[x]) * multiplier) >> 32);
+    }
+}
+
+static inline void fade_row(uint16_t *dst, const uint16_t *src, int count, uint32_t multiplier, uint32_t) {
+    for (int x = 0; x < count; ++x) {
+        dst[x] = uint16_t((uint64_t(src[x]) * multiplier) >> 32);
+    }
+}
+
+static inline void fade_row(float *dst, const float *src, int count, uint32_t multiplier, uint32_t fade) {
+    const float scale = float(fade_numerator(multiplier, fade)) / fade;
+    for (int x = 0; x < count; ++x) {
+        dst[x] = src[x] * scale;
+    }
+}
+
+template <typename T>
+static inline void threshold_copy_row(T *dst, const T *src, int count, T thresh) {
+    for (int x = 0; x < count; ++x) {
+        dst[x] = src[x] >= thresh ? src[x] : T(0);
+    }
+}
+
+/* packs up to 64 pixels into one bitmap word */
+template <typename T>
+static inline uint64_t threshold_word(const T *src, int count, T thresh) {
+    uint64_t word = 0;
+    for (int x = 0; x < count; ++x) {
+        word |= uint64_t(src[x] >= thresh) << x;
+    }
+    return word;
+}
+
+/* flags of a row whose words were ORed into any and ANDed into all */
+static inline int scan_flags(uint64_t any, uint64_t all) {
+    return (any ? scan_white : 0) | (~all ? scan_black : 0);
+}
+
+/* bits past count set, so a partial word ANDs like a full one */
+static inline uint64_t pad_word(uint64_t word, int count) {
+    return count == 64 ? word : word | (~uint64_t(0) << count);
+}
+
+static inline int bitmap_stride(int width) {
+    return (width + 63) / 64;
+}
+
+static inline int bit_scan_forward(uint64_t value) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, (unsigned long)value)) {
+        return index;
+    }
+    _BitScanForward(&index, (unsigned long)(value >> 32));
+    return index + 32;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+/* position of the first set bit at or after x, or words * 64 if there is none */
+static inline int find_set_bit(const uint64_t *row, int x, int words) {
+    int i = x / 64;
+    if (i >= words) {
+        return words * 64;
+    }
+    uint64_t word = row[i] & (~uint64_t(0) << (x % 64));
+    while (!word) {
+        if (++i == words) {
+            return words * 64;
+        }
+        word = row[i];
+    }
+    return i * 64 + bit_scan_forward(word);
+}
+
+/* position of the first clear bit at or after x, or words * 64 if there is none */
+static inline int find_clear_bit(const uint64_t *row, int x, int words) {
+    int i = x / 64;
+    if (i >= words) {
+        return words * 64;
+    }
+    uint64_t word = ~row[i] & (~uint64_t(0) << (x % 64));
+    while (!word) {
+        if (++i == words) {
+            return words * 64;
+        }
+        word = ~row[i];
+    }
+    return i * 64 + bit_scan_forward(word);
+}
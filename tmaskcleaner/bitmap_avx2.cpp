@@ -0,0 +1,195 @@
+#include "bitmap.h"
+
+#ifdef TMC_X86
+#include <immintrin.h>
+
+static inline __m256i splat_avx2(uint8_t thresh) {
+    return _mm256_set1_epi8(thresh);
+}
+
+static inline __m256i splat_avx2(uint16_t thresh) {
+    return _mm256_set1_epi16(thresh);
+}
+
+static inline __m256 splat_avx2(float thresh) {
+    return _mm256_set1_ps(thresh);
+}
+
+static inline uint64_t threshold_word_avx2(const uint8_t *src, __m256i t) {
+    __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32));
+    uint32_t lo_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(lo, t), lo));
+    uint32_t hi_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(hi, t), hi));
+    return lo_mask | (uint64_t(hi_mask) << 32);
+}
+
+static inline uint64_t threshold_word_avx2(const uint16_t *src, __m256i t) {
+    uint64_t word = 0;
+    for (int i = 0; i < 2; ++i) {
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 32));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 32 + 16));
+        __m256i white_lo = _mm256_cmpeq_epi16(_mm256_max_epu16(lo, t), lo);
+        __m256i white_hi = _mm256_cmpeq_epi16(_mm256_max_epu16(hi, t), hi);
+        /* packs works per 128-bit lane, restore the pixel order before taking the mask */
+        __m256i white = _mm256_permute4x64_epi64(_mm256_packs_epi16(white_lo, white_hi), _MM_SHUFFLE(3, 1, 2, 0));
+        word |= uint64_t(uint32_t(_mm256_movemask_epi8(white))) << (i * 32);
+    }
+    return word;
+}
+
+static inline uint64_t threshold_word_avx2(const float *src, __m256 t) {
+    uint64_t word = 0;
+    for (int i = 0; i < 8; ++i) {
+        __m256 v = _mm256_loadu_ps(src + i * 8);
+        word |= uint64_t(_mm256_movemask_ps(_mm256_cmp_ps(v, t, _CMP_GE_OQ))) << (i * 8);
+    }
+    return word;
+}
+
+/* copies 32 bytes of pixels, zeroing the ones below t */
+static inline void threshold_copy_avx2(uint8_t *dst, const uint8_t *src, __m256i t) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_and_si256(v, _mm256_cmpeq_epi8(_mm256_max_epu8(v, t), v)));
+}
+
+static inline void threshold_copy_avx2(uint16_t *dst, const uint16_t *src, __m256i t) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_and_si256(v, _mm256_cmpeq_epi16(_mm256_max_epu16(v, t), v)));
+}
+
+static inline void threshold_copy_avx2(float *dst, const float *src, __m256 t) {
+    __m256 v = _mm256_loadu_ps(src);
+    _mm256_storeu_ps(dst, _mm256_and_ps(v, _mm256_cmp_ps(v, t, _CMP_GE_OQ)));
+}
+
+/* high halves of the products of 8 unsigned dwords with m */
+static inline __m256i mulhi_epu32_avx2(__m256i v, __m256i m) {
+    __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(v, m), 32);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(v, 32), m);
+    return _mm256_blend_epi32(even, odd, 0xAA);
+}
+
+/* fades 16 pixels; packus works per 128-bit lane, so the permute restores the pixel order */
+static inline void fade_avx2(uint8_t *dst, const uint8_t *src, __m256i m) {
+    __m256i lo = mulhi_epu32_avx2(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src))), m);
+    __m256i hi = mulhi_epu32_avx2(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + 8))), m);
+    __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+    __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), bytes);
+}
+
+static inline void fade_avx2(uint16_t *dst, const uint16_t *src, __m256i m) {
+    __m256i lo = mulhi_epu32_avx2(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))), m);
+    __m256i hi = mulhi_epu32_avx2(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 8))), m);
+    __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), words);
+}
+
+static inline void fade_avx2(float *dst, const float *src, __m256 scale) {
+    _mm256_storeu_ps(dst, _mm256_mul_ps(_mm256_loadu_ps(src), scale));
+    _mm256_storeu_ps(dst + 8, _mm256_mul_ps(_mm256_loadu_ps(src + 8), scale));
+}
+
+static inline __m256i fade_factor_avx2(uint8_t, uint32_t multiplier, uint32_t) {
+    return _mm256_set1_epi32(int(multiplier));
+}
+
+static inline __m256i fade_factor_avx2(uint16_t, uint32_t multiplier, uint32_t) {
+    return _mm256_set1_epi32(int(multiplier));
+}
+
+static inline __m256 fade_factor_avx2(float, uint32_t multiplier, uint32_t fade) {
+    return _mm256_set1_ps(float(fade_numerator(multiplier, fade)) / fade);
+}
+
+template <typename T>
+void threshold_avx2(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, T thresh) {
+    const auto t = splat_avx2(thresh);
+    const int simd_width = width & ~63;
+
+    for (int y = 0; y < height; ++y) {
+        const T *row = reinterpret_cast<const T*>(src);
+        for (int x = 0; x < simd_width; x += 64) {
+            dst[x / 64] = threshold_word_avx2(row + x, t);
+        }
+        if (simd_width < width) {
+            dst[simd_width / 64] = threshold_word(row + simd_width, width - simd_width, thresh);
+        }
+        src += src_pitch;
+        dst += dst_stride;
+    }
+    _mm256_zeroupper();
+}
+
+template <typename T>
+void threshold_copy_avx2(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, T thresh) {
+    const auto t = splat_avx2(thresh);
+    const int step = 32 / sizeof(T);
+    const int simd_width = width - width % step;
+
+    for (int y = 0; y < height; ++y) {
+        const T *src_row = reinterpret_cast<const T*>(src);
+        T *dst_row = reinterpret_cast<T*>(dst);
+        for (int x = 0; x < simd_width; x += step) {
+            threshold_copy_avx2(dst_row + x, src_row + x, t);
+        }
+        threshold_copy_row(dst_row + simd_width, src_row + simd_width, width - simd_width, thresh);
+        src += src_pitch;
+        dst += dst_pitch;
+    }
+    _mm256_zeroupper();
+}
+
+template <typename T>
+int scan_avx2(const uint8_t *src, int src_pitch, int width, int height, T thresh) {
+    const auto t = splat_avx2(thresh);
+    const int simd_width = width & ~63;
+    int flags = 0;
+
+    for (int y = 0; y < height && flags != (scan_white | scan_black); ++y) {
+        const T *row = reinterpret_cast<const T*>(src);
+        uint64_t any = 0;
+        uint64_t all = ~uint64_t(0);
+        for (int x = 0; x < simd_width; x += 64) {
+            uint64_t word = threshold_word_avx2(row + x, t);
+            any |= word;
+            all &= word;
+        }
+        if (simd_width < width) {
+            uint64_t word = threshold_word(row + simd_width, width - simd_width, thresh);
+            any |= word;
+            all &= pad_word(word, width - simd_width);
+        }
+        flags |= scan_flags(any, all);
+        src += src_pitch;
+    }
+    _mm256_zeroupper();
+    return flags;
+}
+
+/* runs are short, so every kernel call handles 16 pixels at a time */
+template <typename T>
+void fade_avx2(T *dst, const T *src, int count, uint32_t multiplier, uint32_t fade) {
+    const auto m = fade_factor_avx2(T(), multiplier, fade);
+    const int simd_count = count & ~15;
+
+    for (int x = 0; x < simd_count; x += 16) {
+        fade_avx2(dst + x, src + x, m);
+    }
+    fade_row(dst + simd_count, src + simd_count, count - simd_count, multiplier, fade);
+    _mm256_zeroupper();
+}
+
+template void threshold_avx2<uint8_t>(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, uint8_t thresh);
+template void threshold_avx2<uint16_t>(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, uint16_t thresh);
+template void threshold_avx2<float>(uint64_t *dst, int dst_stride, const uint8_t *src, int src_pitch, int width, int height, float thresh);
+template void threshold_copy_avx2<uint8_t>(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, uint8_t thresh);
+template void threshold_copy_avx2<uint16_t>(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, uint16_t thresh);
+template void threshold_copy_avx2<float>(uint8_t *dst, int dst_pitch, const uint8_t *src, int src_pitch, int width, int height, float thresh);
+template int scan_avx2<uint8_t>(const uint8_t *src, int src_pitch, int width, int height, uint8_t thresh);
+template int scan_avx2<uint16_t>(const uint8_t *src, int src_pitch, int width, int height, uint16_t thresh);
+template int scan_avx2<float>(const uint8_t *src, int src_pitch, int width, int height, float thresh);
+template void fade_avx2<uint8_t>(uint8_t *dst, const uint8_t *src, int count, uint32_t multiplier, uint32_t fade);
+template void fade_avx2<uint16_t>(uint16_t *dst, const uint16_t *src, int count, uint32_t multiplier, uint32_t fade);
+template void fade_avx2<float>(float *dst, const float *src, int count, uint32_t multiplier, uint32_t fade);
+#endif
@@ -0,0 +1,1034 @@
+#include "cleaner.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <vector>
+#if defined(TMC_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(TMC_X86)
+#include <cpuid.h>
+#endif
+
+/* label factor of components that are copied unfaded */
+static const uint32_t copy_factor = UINT32_MAX;
+
+/* smallest stripe worth handing to another thread */
+static const int min_stripe_height = 64;
+
+/* rows thresholded against both thresholds at a time, so the second pass reads them from cache */
+static const int hysteresis_band = 16;
+
+/* names of the engine parameter in the order of Engine */
+static const char *const engine_names[] = { "floodfill", "unionfind", "runs", "auto" };
+
+/* labelings the stats report besides the engines */
+static const char *const parallel_labeling = "parallel";
+static const char *const temporal_labeling = "temporal";
+static const char *const mixed_labeling = "mixed";
+
+/* the diamond keeps a row per radius for every row in reach, so the ring grows quadratically */
+static const int max_expand = 16;
+
+/* expanded pixels of a copied component are only dropped in chunks, the buffer stays in L1 */
+static const size_t min_queue_drop = 2048;
+
+/* pixel at offset y * width + x */
+template <typename T>
+static inline T &pixel_at(uint8_t *plane, int pitch, int width, uint32_t offset) {
+    return reinterpret_cast<T*>(plane + pitch * int(offset / width))[offset % width];
+}
+
+template <typename T>
+static inline const T &pixel_at(const uint8_t *plane, int pitch, int width, uint32_t offset) {
+    return reinterpret_cast<const T*>(plane + pitch * int(offset / width))[offset % width];
+}
+
+/* n / fade as the 0.32 fixed point multiplier of the fade kernels, below copy_factor since n < fade */
+static inline uint32_t fade_multiplier(size_t n, uint32_t fade) {
+    return uint32_t(((uint64_t(n) << 32) + fade - 1) / fade);
+}
+
+/* the multiplier is only exact while every sample times fade fits 32 bits */
+static inline bool exact_fade(uint8_t, uint32_t fade) {
+    return uint64_t(UINT8_MAX) * fade <= UINT32_MAX;
+}
+
+static inline bool exact_fade(uint16_t, uint32_t fade) {
+    return uint64_t(UINT16_MAX) * fade <= UINT32_MAX;
+}
+
+static inline bool exact_fade(float, uint32_t) {
+    return true;
+}
+
+/* Fades single pixels like the fade kernels, which only pay off on whole rows. Integer samples
+   divide like fade_divide_c when the multiplier isn't exact. */
+template <typename T>
+class PixelFade {
+public:
+    PixelFade(uint32_t multiplier, uint32_t fade)
+        : multiplier_(multiplier), numerator_(fade_numerator(multiplier, fade)), fade_(fade), exact_(exact_fade(T(), fade)) {}
+
+    T operator()(T value) const {
+        return exact_ ? T((uint64_t(value) * multiplier_) >> 32) : T(uint64_t(value) * numerator_ / fade_);
+    }
+
+private:
+    uint32_t multiplier_;
+    uint32_t numerator_;
+    uint32_t fade_;
+    bool exact_;
+};
+
+template <>
+class PixelFade<float> {
+public:
+    PixelFade(uint32_t multiplier, uint32_t fade) : scale_(float(fade_numerator(multiplier, fade)) / fade) {}
+
+    float operator()(float value) const {
+        return value * scale_;
+    }
+
+private:
+    float scale_;
+};
+
+int cpu_features() {
+    int features = 0;
+#ifdef TMC_X86
+    unsigned int regs[4];
+#ifdef _MSC_VER
+    __cpuid(reinterpret_cast<int*>(regs), 1);
+#else
+    __cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    if (regs[3] & (1 << 26)) {
+        features |= cpu_sse2;
+    }
+    /* avx needs os support for saving the ymm registers */
+    const unsigned int osxsave_avx = (1 << 27) | (1 << 28);
+    if ((regs[2] & osxsave_avx) == osxsave_avx) {
+#ifdef _MSC_VER
+        uint64_t xcr0 = _xgetbv(0);
+        __cpuidex(reinterpret_cast<int*>(regs), 7, 0);
+#else
+        unsigned int xcr0_lo, xcr0_hi;
+        __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+        uint64_t xcr0 = xcr0_lo | (uint64_t(xcr0_hi) << 32);
+        __cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+        if ((xcr0 & 6) == 6 && (regs[1] & (1 << 5))) {
+            features |= cpu_avx2;
+        }
+    }
+#endif
+    return features;
+}
+
+const char *check_parameters(int length, int thresh, int thresh_high, int fade, int connectivity, int temporal, int threads, int expand) {
+    if (length <= 0 || thresh <= 0) {
+        return "TMaskCleaner: length and thresh must be greater than zero.";
+    }
+    if (thresh_high < thresh) {
+        return "TMaskCleaner: thresh_high cannot be lower than thresh.";
+    }
+    if (fade < 0) {
+        return "TMaskCleaner: fade cannot be negative.";
+    }
+    if (connectivity != 4 && connectivity != 8) {
+        return "TMaskCleaner: connectivity must be 4 or 8.";
+    }
+    if (temporal < 0) {
+        return "TMaskCleaner: temporal cannot be negative.";
+    }
+    if (threads < 0) {
+        return "TMaskCleaner: threads cannot be negative.";
+    }
+    if (expand < 0 || expand > max_expand) {
+        return "TMaskCleaner: expand must be between 0 and 16.";
+    }
+    return nullptr;
+}
+
+bool parse_engine(const char *name, Engine &engine) {
+    for (int i = 0; i < 4; ++i) {
+        if (!strcmp(name, engine_names[i])) {
+            engine = Engine(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *engine_name(Engine engine) {
+    return engine_names[int(engine)];
+}
+
+bool parse_expand_shape(const char *name, ExpandShape &shape) {
+    if (!strcmp(name, "square")) {
+        shape = ExpandShape::Square;
+    } else if (!strcmp(name, "diamond")) {
+        shape = ExpandShape::Diamond;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* converts a threshold on the 8 bit scale to samples of bits, false if no sample can reach it */
+template <typename T>
+static bool scale_thresh(int thresh, int bits, T &scaled) {
+    if (bits == 32) {
+        scaled = T(thresh / 255.0);
+        return true;
+    }
+    uint64_t value = uint64_t(thresh) << (bits - 8);
+    if (value >= (uint64_t(1) << bits)) {
+        scaled = T(0);
+        return false;
+    }
+    scaled = T(value);
+    return true;
+}
+
+/* the frame cache holds a window of every plane plus one frame of slack for out of order requests */
+template <typename T>
+Cleaner<T>::Cleaner(int width, int height, int length, int thresh, int thresh_high, int fade, int connectivity, int temporal, int threads, int bits, int cpu, Engine engine,
+                   int expand, ExpandShape expand_shape)
+: length_(length), fade_(fade), hysteresis_(thresh_high > thresh), connectivity_(connectivity), temporal_(temporal),
+  expand_(expand), expand_shape_(expand_shape), engine_(engine), workspaces_(width, height), frames_(size_t(2 * temporal + 2) * 3) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads > 1) {
+        pool_.reset(new ThreadPool(threads));
+    }
+
+    never_white_ = !scale_thresh(thresh, bits, thresh_);
+    never_seed_ = !scale_thresh(thresh_high, bits, thresh_high_);
+
+    scan_ = scan_c<T>;
+    threshold_ = threshold_c<T>;
+    threshold_copy_ = threshold_copy_c<T>;
+    fade_pixels_ = fade_c<T>;
+    hash_ = hash_plane_c;
+#ifdef TMC_X86
+    if (cpu & cpu_avx2) {
+        scan_ = scan_avx2<T>;
+        threshold_ = threshold_avx2<T>;
+        threshold_copy_ = threshold_copy_avx2<T>;
+        fade_pixels_ = fade_avx2<T>;
+    } else if (cpu & cpu_sse2) {
+        scan_ = scan_sse2<T>;
+        threshold_ = threshold_sse2<T>;
+        threshold_copy_ = threshold_copy_sse2<T>;
+        fade_pixels_ = fade_sse2<T>;
+    }
+    if (cpu & cpu_sse2) {
+        hash_ = hash_plane_sse2;
+    }
+#endif
+    if (!exact_fade(T(), fade_)) {
+        fade_pixels_ = fade_divide_c<T>;
+    }
+}
+
+/* planes of a frame add up */
+static void add_stats(MaskStats *stats, const Workspace &ws, const char *labeling) {
+    stats->white += ws.white_count;
+    stats->components += ws.component_count;
+    stats->largest = std::max(stats->largest, ws.largest_component);
+    stats->removed += ws.removed_count;
+    stats->peak_queue = std::max(stats->peak_queue, ws.peak_queue);
+    stats->engine = !stats->engine || stats->engine == labeling ? labeling : mixed_labeling;
+}
+
+template <typename T>
+void Cleaner<T>::clear_mask(uint8_t *dst, const uint8_t *src, int w, int h, int src_pitch, int dst_pitch, MaskStats *stats) {
+    std::unique_ptr<Workspace> ws = workspaces_.acquire();
+    const char *labeling;
+    if (connectivity_ == 4) {
+        labeling = clear_mask<4>(dst, src, w, h, src_pitch, dst_pitch, *ws);
+    } else {
+        labeling = clear_mask<8>(dst, src, w, h, src_pitch, dst_pitch, *ws);
+    }
+    if (expand_ > 0) {
+        expand_plane(dst, w, h, dst_pitch, *ws);
+    }
+    if (stats) {
+        add_stats(stats, *ws, labeling);
+    }
+    workspaces_.release(std::move(ws));
+}
+
+/* A white plane is a single component with either connectivity, but in temporal mode it still
+   depends on the neighbours, and expand makes a kept one differ from the source. Mixed planes
+   usually stop the scan within the first rows. */
+template <typename T>
+PlaneResult Cleaner<T>::classify_plane(const uint8_t *src, int w, int h, int src_pitch, MaskStats *stats) const {
+    int flags = never_white_ ? scan_black : scan_(src, src_pitch, w, h, thresh_);
+    if (flags & scan_black) {
+        return flags & scan_white ? PlaneResult::Mixed : PlaneResult::Black;
+    }
+    if (temporal_ > 0) {
+        return PlaneResult::Mixed;
+    }
+
+    size_t pixels_count = size_t(w) * h;
+    bool seeded = !hysteresis_ || (!never_seed_ && (scan_(src, src_pitch, w, h, thresh_high_) & scan_white));
+    bool kept = seeded && pixels_count >= length_ && (pixels_count > length_ || fade_ == 0);
+    if (kept && (pixels_count - length_ < fade_ || expand_ > 0)) {
+        return PlaneResult::Mixed;
+    }
+    if (stats) {
+        stats->white += pixels_count;
+        stats->components++;
+        stats->largest = std::max(stats->largest, pixels_count);
+        stats->removed += kept ? 0 : pixels_count;
+    }
+    return kept ? PlaneResult::Source : PlaneResult::Black;
+}
+
+template <typename T>
+std::shared_ptr<const ThresholdedPlane> Cleaner<T>::cached_plane(int frame, int plane) {
+    return frames_.find(frame, plane);
+}
+
+static std::shared_ptr<ThresholdedPlane> black_plane(int w, int h) {
+    std::shared_ptr<ThresholdedPlane> thresholded(new ThresholdedPlane());
+    thresholded->width = w;
+    thresholded->height = h;
+    thresholded->bitmap_stride = bitmap_stride(w);
+    thresholded->white.resize(size_t(thresholded->bitmap_stride) * h);
+    return thresholded;
+}
+
+template <typename T>
+std::shared_ptr<const ThresholdedPlane> Cleaner<T>::threshold_plane(int frame, int plane, const uint8_t *src, int w, int h, int src_pitch) {
+    std::shared_ptr<ThresholdedPlane> thresholded = black_plane(w, h);
+    if (!never_white_) {
+        threshold_(thresholded->white.data(), thresholded->bitmap_stride, src, src_pitch, w, h, thresh_);
+    }
+    frames_.insert(frame, plane, thresholded);
+    return thresholded;
+}
+
+template <typename T>
+void Cleaner<T>::cache_black_plane(int frame, int plane, int w, int h) {
+    frames_.insert(frame, plane, black_plane(w, h));
+}
+
+template <typename T>
+void Cleaner<T>::clear_mask_temporal(uint8_t *dst, const uint8_t *src, int w, int h, int src_pitch, int dst_pitch,
+                                     const ThresholdedPlane &current, const ThresholdedPlane *const *neighbours, int neighbour_count, MaskStats *stats) {
+    std::unique_ptr<Workspace> ws = workspaces_.acquire();
+    if (connectivity_ == 4) {
+        clear_mask_temporal<4>(dst, src, w, h, src_pitch, dst_pitch, current, neighbours, neighbour_count, *ws);
+    } else {
+        clear_mask_temporal<8>(dst, src, w, h, src_pitch, dst_pitch, current, neighbours, neighbour_count, *ws);
+    }
+    if (expand_ > 0) {
+        expand_plane(dst, w, h, dst_pitch, *ws);
+    }
+    if (stats) {
+        add_stats(stats, *ws, temporal_labeling);
+    }
+    workspaces_.release(std::move(ws));
+}
+
+/* Fills the component of a pixel, given as a bit of the padded white, and returns its size. Pixels
+   of components too small to be copied unfaded stay in white_pixels. Once a component is known to
+   be copied, expanded pixels are dropped from the front of the queue, so white_pixels only grows
+   with the fill front from then on. seeded starts out true unless the component still has to reach
+   thresh_high somewhere. */
+template <typename T>
+template <int connectivity>
+size_t Cleaner<T>::process_pixel(uint32_t bit, size_t copy_length, bool &seeded, Workspace &ws) {
+    /* pixels already collected are expanded in order, so no separate stack is needed */
+    std::vector<uint32_t> &white_pixels = ws.white_pixels;
+    size_t next = 0;
+    size_t dropped = 0;
+    size_t peak_queue = 0;
+
+    /* neighbours in the padded bitmap, the diagonals last so 4-connectivity uses the first four */
+    const int row = ws.bitmap_stride * 64;
+    const int offsets[8] = { -row, -1, 1, row, -row - 1, -row + 1, row - 1, row + 1 };
+
+    white_pixels.push_back(bit);
+    ws.consume(bit);
+
+    while (next < white_pixels.size()) {
+        peak_queue = std::max(peak_queue, white_pixels.size() - next);
+        /* moving the queue down once half of the buffer is expanded keeps it amortized O(1) per pixel */
+        if (next >= min_queue_drop && next >= white_pixels.size() / 2 && seeded && dropped + white_pixels.size() >= copy_length) {
+            dropped += next;
+            white_pixels.erase(white_pixels.begin(), white_pixels.begin() + next);
+            next = 0;
+        }
+        uint32_t current = white_pixels[next++];
+        if (!seeded) {
+            seeded = ws.is_seed(current);
+        }
+        for (int k = 0; k < connectivity; ++k) {
+            ws.fill(current + offsets[k]);
+        }
+    }
+    ws.peak_queue = std::max(ws.peak_queue, peak_queue);
+    return dropped + white_pixels.size();
+}
+
+template <typename T>
+void Cleaner<T>::threshold_rows(const uint8_t *src, int src_pitch, int w, int y_begin, int y_end, Workspace &ws) {
+    uint64_t *white = ws.white.data() + ws.bitmap_offset + ws.bitmap_stride * y_begin;
+    if (never_white_) {
+        memset(white, 0, ws.bitmap_stride * (y_end - y_begin) * sizeof(uint64_t));
+    } else if (!hysteresis_) {
+        threshold_(white, ws.bitmap_stride, src + src_pitch * y_begin, src_pitch, w, y_end - y_begin, thresh_);
+    } else {
+        threshold_seeds(src, src_pitch, w, y_begin, y_end, ws);
+    }
+}
+
+/* white pixels and seeds, the pixels that reach thresh_high; thresh_high > thresh keeps seeds a subset of white */
+template <typename T>
+void Cleaner<T>::threshold_seeds(const uint8_t *src, int src_pitch, int w, int y_begin, int y_end, Workspace &ws) {
+    for (int y = y_begin; y < y_end; y += hysteresis_band) {
+        int rows = std::min(hysteresis_band, y_end - y);
+        uint64_t *white = ws.white.data() + ws.bitmap_offset + ws.bitmap_stride * y;
+        uint64_t *seeds = ws.seeds.data() + ws.bitmap_offset + ws.bitmap_stride * y;
+        threshold_(white, ws.bitmap_stride, src + src_pitch * y, src_pitch, w, rows, thresh_);
+        if (never_seed_) {
+            memset(seeds, 0, ws.bitmap_stride * rows * sizeof(uint64_t));
+        } else {
+            threshold_(seeds, ws.bitmap_stride, src + src_pitch * y, src_pitch, w, rows, thresh_high_);
+        }
+    }
+}
+
+/* flags every root of the flattened label image that has a seed */
+template <typename T>
+void Cleaner<T>::mark_seeds(int w, int h, uint32_t label_count, Workspace &ws) {
+    const int stride = w + 2;
+    ws.seeded.assign(label_count, 0);
+    for (int y = 0; y < h; ++y) {
+        const uint64_t *seed_row = ws.seeds.data() + ws.bitmap_stride * y;
+        const uint32_t *row = ws.labels.data() + stride * (y + 1) + 1;
+        for (int i = 0; i < ws.bitmap_stride; ++i) {
+            for (uint64_t seeds = seed_row[i]; seeds; seeds &= seeds - 1) {
+                ws.seeded[ws.parents[row[i * 64 + bit_scan_forward(seeds)]]] = 1;
+            }
+        }
+    }
+}
+
+/* When most white pixels end up in kept components, writing the thresholded source and erasing
+   the rest touches less memory than clearing the plane and writing back everything that's kept. */
+static inline bool erase_output(const Workspace &ws) {
+    return ws.kept_count > ws.white_count - ws.kept_count;
+}
+
+template <typename T>
+template <int connectivity>
+const char *Cleaner<T>::clear_mask(uint8_t *dst, const uint8_t *src, int w, int h, int src_pitch, int dst_pitch, Workspace &ws) {
+    ws.bitmap_stride = bitmap_stride(w);
+    ws.bitmap_offset = 0;
+    ws.reset_counts();
+    if (hysteresis_) {
+        ws.seeds.resize(ws.white.size());
+    }
+    if (pool_ && h >= 2 * min_stripe_height) {
+        clear_mask_parallel<connectivity>(dst, src, w, h, src_pitch, dst_pitch, ws);
+        return parallel_labeling;
+    }
+    /* trials include thresholding, so engines are compared on everything they do for a plane */
+    Engine engine = engine_;
+    bool trial = false;
+    EngineTuner::Clock::time_point start;
+    if (engine == Engine::Auto) {
+        engine = tuner_.pick(trial);
+        start = EngineTuner::Clock::now();
+    }
+    if (engine == Engine::FloodFill) {
+        ws.pad_bitmaps(w, h, hysteresis_);
+    }
+    threshold_rows(src, src_pitch, w, 0, h, ws);
+
+    switch (engine) {
+    case Engine::FloodFill:
+        clear_mask_flood_fill<connectivity>(dst, src, w, h, src_pitch, dst_pitch, ws);
+        break;
+    case Engine::UnionFind:
+        clear_mask_union_find<connectivity>(dst, src, w, h, src_pitch, dst_pitch, ws);
+        break;
+    case Engine::Runs:
+        clear_mask_runs<connectivity>(dst, src, w, h, src_pitch, dst_pitch, ws);
+        break;
+    case Engine::Auto:
+        break;
+    }
+    if (trial) {
+        tuner_.report(engine, start, size_t(w) * h);
+    }
+    return engine_names[int(engine)];
+}
+
+/* The output starts as the thresholded source, so components that are copied unfaded are already
+   written and never need to be buffered; only the smaller ones are erased or faded afterwards. */
+template <typename T>
+template <int connectivity>
+void Cleaner<T>::clear_mask_flood_fill(uint8_t *dst, const uint8_t *src, int w, int h, int src_pitch, int dst_pitch, Workspace &ws) {
+    /* threshold_copy can't express a threshold above the sample range */
+    if (never_white_) {
+        memset(dst, 0, dst_pitch * h);
+        return;
+    }
+    /* Unlike the label engines this always erases from the thresholded source. erase_output needs
+       the kept share before anything is written, and copied components aren't buffered to be
+       written back later. */
+    threshold_copy_(dst, dst_pitch, src, src_pitch, w, h, thresh_);
+    const std::vector<uint32_t> &white_pixels = ws.white_pixels;
+    /* smallest component that component_factor copies unfaded */
+    const size_t copy_length = length_ + fade_;
+
+    /* pixels are bits of the padded white, rows of row bits starting at first */
+    const int row = ws.bitmap_stride * 64;
+    const uint32_t first = uint32_t(ws.bitmap_offset) * 64;
+
+    /* white is consumed by the fills, so every set bit left is the first pixel of a new component */
+    for(int y = 0; y < h; ++y) {
+        const uint64_t *white_row = ws.white.data() + ws.bitmap_offset + ws.bitmap_stride * y;
+        for(int x = find_set_bit(white_row, 0, ws.bitmap_stride); x < w; x = find_set_bit(white_row, x + 1, ws.bitmap_stride)) {
+            ws.white_pixels.clear();
+            bool seeded = !hysteresis_;
+            size_t pixels_count = process_pixel<connectivity>(first + uint32_t(y) * row + x, copy_length, seeded, ws);
+            uint32_t factor = component_factor(pixels_count, seeded, ws);
+            if (factor == 0) {
+                for (size_t i = 0; i < white_pixels.size(); ++i) {
+                    pixel_at<T>(dst, dst_pitch, row, white_pixels[i] - first) = 0;
+                }
+            } else if (factor != copy_factor) {
+                /* the pixels are scattered, but dst already holds their source values */
+                const PixelFade<T> fade(factor, fade_);
+                for (size_t i = 0; i < white_pixels.size(); ++i) {
+                    T &pixel = pixel_at<T>(dst, dst_pitch, row, white_pixels[i] - first);
+                    pixel = fade(pixel);
+                }
+            }
+        }
+    }
+}
+
+template <typename T>
+template <int connectivity>
+uint32_t Cleaner<T>::label_rows(int w, int y_begin, int y_end, uint32_t next_label, Workspace &ws) {
+    const int stride = w + 2;
+
+    for (int y = y_begin; y < y_end; ++y) {
+        const uint64_t *white_row = ws.white.data() + ws.bitmap_stride * y;
+        uint32_t *row = ws.labels.data() + stride * (y + 1) + 1;
+        /* the first row of a stripe looks at the zero border row, so stripes can be labeled independently */
+        const uint32_t *prev = y == y_begin ? ws.labels.data() + 1 : row - stride;
+        row[-1] = 0;
+
+        int x = 0;
+        for (int start = find_set_bit(white_row, 0, ws.bitmap_stride); start < w; start = find_set_bit(white_row, x, ws.bitmap_stride)) {
+            int end = find_clear_bit(white_row, start, ws.bitmap_stride);
+            memset(row + x, 0, (start - x) * sizeof(uint32_t));
+
+            for (x = start; x < end; ++x) {
+                /* decision tree over the already scanned neighbours: a b c / d, or b / d */
+                uint32_t label;
+                if (connectivity == 4) {
+                    if (prev[x]) {
+                        label = prev[x];
+                        if (row[x - 1] && row[x - 1] != label) {
+                            label = ws.merge(label, row[x - 1]);
+                        }
+                    } else if (row[x - 1]) {
+                        label = row[x - 1];
+                    } else {
+                        label = next_label++;
+                        ws.parents[label] = label;
+                        ws.areas[label] = 0;
+                    }
+                } else if (prev[x]) {
+                    label = prev[x];
+                } else if (prev[x + 1]) {
+                    label = prev[x + 1];
+                    if (prev[x - 1]) {
+                        label = ws.merge(label, prev[x - 1]);
+                    } else if (row[x - 1]) {
+                        label = ws.merge(label, row[x - 1]);
+                    }
+                } else if (prev[x - 1]) {
+                    label = prev[x - 1];
+                } else if (row[x - 1]) {
+                    label = row[x - 1];
+                } else {
+                    label = next_label++;
+                    ws.parents[label] = label;
+                    ws.areas[label] = 0;
+                }
+                row[x] = label;
+                ws.areas[label]++;
+            }
+        }
+        memset(row + x, 0, (w + 1 - x) * sizeof(uint32_t));
+    }
+    return next_label;
+}
+
+template <typename T>
+void Cleaner<T>::write_rows(uint8_t *dst, const uint8_t *src, int w, int y_begin, int y_end, int src_pitch, int dst_pitch, Workspace &ws) {
+    const int stride = w + 2;
+
+    /* every run lies in a single component, so the rule is applied per run */
+    for (int y = y_begin; y < y_end; ++y) {
+        const uint64_t *white_row = ws.white.data() + ws.bitmap_stride * y;
+        const T *src_row = reinterpret_cast<const T*>(src + src_pitch * y);
+        T *dst_row = reinterpret_cast<T*>(dst + dst_pitch * y);
+        const uint32_t *row = ws.labels.data() + stride * (y + 1) + 1;
+
+        int x = 0;
+        for (int start = find_set_bit(white_row, 0, ws.bitmap_stride); start < w; start = find_set_bit(white_row, x, ws.bitmap_stride)) {
+            int end = find_clear_bit(white_row, start, ws.bitmap_stride);
+            memset(dst_row + x, 0, (start - x) * sizeof(T));
+            write_run(dst_row, src_row, start, end, ws.areas[ws.parents[row[start]]]);
+            x = end;
+        }
+        memset(dst_row + x, 0, (w - x) * sizeof(T));
+    }
+}
+
+template <typename T>
+void Cleaner<T>::erase_rows(uint8_t *dst, const uint8_t *src, int w, int y_begin, int y_end, int src_pitch, int dst_pitch, Workspace &ws) {
+    const int stride = w + 2;
+
+    threshold_copy_(dst + dst_pitch * y_begin, dst_pitch, src + src_pitch * y_begin, src_pitch, w, y_end - y_begin, thresh_);
+    for (int y = y_begin; y < y_end; ++y) {
+        const uint64_t *white_row = ws.white.data() + ws.bitmap_stride * y;
+        const T *src_row = reinterpret_cast<const T*>(src + src_pitch * y);
+        T *dst_row = reinterpret_cast<T*>(dst + dst_pitch * y);
+        const uint32_t *row = ws.labels.data() + stride * (y + 1) + 1;
+
+        for (int start = find_set_bit(white_row, 0, ws.bitmap_stride); start < w; ) {
+            int end = find_clear_bit(white_row, start, ws.bitmap_stride);
+            uint32_t factor = ws.areas[ws.parents[row[start]]];
+            if (factor != copy_factor) {
+                write_run(dst_row, src_row, start, end, factor);
+            }
+            start = find_set_bit(white_row, end, ws.bitmap_stride);
+        }
+    }
+}
+
+template <typename T>
+template <int connectivity>
+void Cleaner<T>::clear_mask_union_find(uint8_t *dst, const uint8_t *src, int w, int h, int src_pitch, int dst_pitch, Workspace &ws) {
+    ws.labels.resize(size_t(ws.width + 2) * (ws.height + 1));
+    ws.reserve_labels(max_labels(ws.width, ws.height, connectivity));
+
+    /* the top border row is always zero */
+    memset(ws.labels.data(), 0, (w + 2) * sizeof(uint32_t));
+    uint32_t label_count = label_rows<connectivity>(w, 0, h, 1, ws);
+    accumulate_areas(1, label_count, ws);
+    if (hysteresis_) {
+        mark_seeds(w, h, label_count, ws);
+    }
+    decide_factors(1, label_count, ws);
+    if (erase_output(ws)) {
+        erase_rows(dst, src, w, 0, h, src_pitch, dst_pitch, ws);
+    } else {
+        write_rows(dst, src, w, 0, h, src_pitch, dst_pitch, ws);
+    }
+}
+
+/* The temporal mode always labels with serial union-find, whose label image is what the overlap
+   test looks up. */
+template <typename T>
+template <int connectivity>
+void Cleaner<T>::clear_mask_temporal(uint8_t *dst, const uint8_t *src, int w, int h, int src_pitch, int dst_pitch,
+                                     const ThresholdedPlane &current, const ThresholdedPlane *const *neighbours, int neighbour_count, Workspace &ws) {
+    const int stride = w + 2;
+    ws.bitmap_stride = current.bitmap_stride;
+    ws.reset_counts();
+    std::copy(current.white.begin(), current.white.end(), ws.white.begin());
+
+    ws.labels.resize(size_t(ws.width + 2) * (ws.height + 1));
+    ws.reserve_labels(max_labels(ws.width, ws.height, connectivity));
+    memset(ws.labels.data(), 0, stride * sizeof(uint32_t));
+    uint32_t label_count = label_rows<connectivity>(w, 0, h, 1, ws);
+    accumulate_areas(1, label_count, ws);
+    if (hysteresis_) {
+        /* only white is cached across frames, seeds of the current one come straight from src */
+        ws.seeds.resize(ws.white.size());
+        if (never_seed_) {
+            std::fill(ws.seeds.begin(), ws.seeds.end(), 0);
+        } else {
+            threshold_(ws.seeds.data(), ws.bitmap_stride, src, src_pitch, w, h, thresh_high_);
+        }
+        mark_seeds(w, h, label_count, ws);
+    }
+
+    /* every label points at its root now; a root counts neighbour k only if it overlapped all before it */
+    ws.hits.assign(label_count, 0);
+    for (int k = 0; k < neighbour_count; ++k) {
+        for (int y = 0; y < h; ++y) {
+            const uint64_t *white_row = ws.white.data() + ws.bitmap_stride * y;
+            const uint64_t *other_row = neighbours[k]->white.data() + ws.bitmap_stride * y;
+            const uint32_t *row = ws.labels.data() + stride * (y + 1) + 1;
+            for (int i = 0; i < ws.bitmap_stride; ++i) {
+                for (uint64_t overlap = white_row[i] & other_row[i]; overlap; overlap &= overlap - 1) {
+                    uint32_t root = ws.parents[row[i * 64 + bit_scan_forward(overlap)]];
+                    if (ws.hits[root] == uint32_t(k)) {
+                        ws.hits[root] = k + 1;
+                    }
+                }
+            }
+        }
+    }
+
+    for (uint32_t label = 1; label < label_count; ++label) {
+        if (ws.parents[label] == label) {
+            uint32_t factor = component_factor(ws.areas[label], !hysteresis_ || ws.seeded[label], ws);
+            if (ws.hits[label] < uint32_t(neighbour_count) && factor != 0) {
+                if (factor == copy_factor) {
+                    ws.kept_count -= ws.areas[label];
+                }
+                ws.removed_count += ws.areas[label];
+                factor = 0;
+            }
+            ws.areas[label] = factor;
+        }
+    }
+
+    if (erase_output(ws)) {
+        erase_rows(dst, src, w, 0, h, src_pitch, dst_pitch, ws);
+    } else {
+        write_rows(dst, src, w, 0, h, src_pitch, dst_pitch, ws);
+    }
+}
+
+template <typename T>
+template <int connectivity>
+void Cleaner<T>::clear_mask_parallel(uint8_t *dst, const uint8_t *src, int w, int h, int src_pitch, int dst_pitch, Workspace &ws) {
+    const int stride = w + 2;
+    const int stripes = std::min(pool_->size(), h / min_stripe_height);
+
+    /* every stripe gets a label range large enough for its worst case */
+    ws.stripe_labels.resize(stripes + 1);
+    ws.stripe_ends.resize(stripes);
+    ws.stripe_labels[0] = 1;
+    for (int s = 0; s < stripes; ++s) {
+        int rows = h * (s + 1) / stripes - h * s / stripes;
+        ws.stripe_labels[s + 1] = ws.stripe_labels[s] + uint32_t(max_labels(w, rows, connectivity) - 1);
+    }
+    ws.labels.resize(size_t(ws.width + 2) * (ws.height + 1));
+    ws.reserve_labels(ws.stripe_labels[stripes]);
+    memset(ws.labels.data(), 0, stride * sizeof(uint32_t));
+
+    pool_->parallel_for(stripes, [&](int s) {
+        int y_begin = h * s / stripes;
+        int y_end = h * (s + 1) / stripes;
+        threshold_rows(src, src_pitch, w, y_begin, y_end, ws);
+        ws.stripe_ends[s] = label_rows<connectivity>(w, y_begin, y_end, ws.stripe_labels[s], ws);
+    });
+
+    /* merging across the seams only touches one row per stripe, which is cheap enough to do serially */
+    for (int s = 1; s < stripes; ++s) {
+        int y = h * s / stripes;
+        const uint64_t *white_row = ws.white.data() + ws.bitmap_stride * y;
+        const uint32_t *row = ws.labels.data() + stride * (y + 1) + 1;
+        const uint32_t *prev = row - stride;
+
+        for (int start = find_set_bit(white_row, 0, ws.bitmap_stride); start < w; ) {
+            int end = find_clear_bit(white_row, start, ws.bitmap_stride);
+            /* with 8-connectivity the pixels diagonally past both ends touch the run too */
+            const int reach = connectivity == 8 ? 1 : 0;
+            for (int x = start - reach; x < end + reach; ++x) {
+                if (prev[x]) {
+                    ws.merge(row[start], prev[x]);
+                }
+            }
+            start = find_set_bit(white_row, end, ws.bitmap_stride);
+        }
+    }
+
+    /* stripes are in ascending label order, so the forest still flattens in one pass */
+    for (int s = 0; s < stripes; ++s) {
+        accumulate_areas(ws.stripe_labels[s], ws.stripe_ends[s], ws);
+    }
+    if (hysteresis_) {
+        mark_seeds(w, h, ws.stripe_labels[stripes], ws);
+    }
+    for (int s = 0; s < stripes; ++s) {
+        decide_factors(ws.stripe_labels[s], ws.stripe_ends[s], ws);
+    }
+
+    bool erase = erase_output(ws);
+    pool_->parallel_for(stripes, [&](int s) {
+        if (erase) {
+            erase_rows(dst, src, w, h * s / stripes, h * (s + 1) / stripes, src_pitch, dst_pitch, ws);
+        } else {
+            write_rows(dst, src, w, h * s / stripes, h * (s + 1) / stripes, src_pitch, dst_pitch, ws);
+        }
+    });
+}
+
+template <typename T>
+void Cleaner<T>::write_run(T *dst_row, const T *src_row, int start, int end, uint32_t factor) {
+    if (factor == copy_factor) {
+        memcpy(dst_row + start, src_row + start, (end - start) * sizeof(T));
+    } else if (factor == 0) {
+        memset(dst_row + start, 0, (end - start) * sizeof(T));
+    } else {
+        fade_pixels_(dst_row + start, src_row + start, end - start, factor, fade_);
+    }
+}
+
+/* dst is the maximum of src at x - 1, x and x + 1, the edges only look inside the row */
+template <typename T>
+static void dilate_row(T *dst, const T *src, int w) {
+    if (w == 1) {
+        dst[0] = src[0];
+        return;
+    }
+    dst[0] = std::max(src[0], src[1]);
+    for (int x = 1; x < w - 1; ++x) {
+        dst[x] = std::max(std::max(src[x - 1], src[x]), src[x + 1]);
+    }
+    dst[w - 1] = std::max(src[w - 2], src[w - 1]);
+}
+
+/* Like dilate_row with radius r, with van Herk's running maxima over blocks of 2r + 1 samples, so
+   the cost doesn't depend on r. scratch holds 3 * (w + 2r) samples. */
+template <typename T>
+static void dilate_row(T *dst, const T *src, int w, int r, T *scratch) {
+    const int block = 2 * r + 1;
+    const int padded = w + 2 * r;
+    T *row = scratch;
+    T *prefix = scratch + padded;
+    T *suffix = prefix + padded;
+    std::fill(row, row + r, std::numeric_limits<T>::lowest());
+    memcpy(row + r, src, w * sizeof(T));
+    std::fill(row + r + w, row + padded, std::numeric_limits<T>::lowest());
+    for (int x = 0; x < padded; ++x) {
+        prefix[x] = x % block == 0 ? row[x] : std::max(prefix[x - 1], row[x]);
+    }
+    for (int x = padded - 1; x >= 0; --x) {
+        suffix[x] = x == padded - 1 || (x + 1) % block == 0 ? row[x] : std::max(suffix[x + 1], row[x]);
+    }
+    /* x - r .. x + r is x .. x + 2r of the padded row, which spans at most two blocks */
+    for (int x = 0; x < w; ++x) {
+        dst[x] = std::max(suffix[x], prefix[x + block - 1]);
+    }
+}
+
+template <typename T>
+static void max_row(T *dst, const T *src, int w) {
+    for (int x = 0; x < w; ++x) {
+        dst[x] = std::max(dst[x], src[x]);
+    }
+}
+
+/* Dilates the finished plane in place with a second pass over it, after the engine wrote it.
+   A ring holds the output rows within reach of the current one, dilated horizontally: the square
+   only needs radius expand of every row, the diamond needs every radius up to expand and takes
+   expand - |dy| from the row dy rows away. Rows loaded into the ring haven't been overwritten yet.
+   Rows without a kept pixel are only flagged, so the black parts of a mask cost a single read. */
+template <typename T>
+void Cleaner<T>::expand_plane(uint8_t *dst, int w, int h, int dst_pitch, Workspace &ws) {
+    const int n = expand_;
+    const int slots = 2 * n + 1;
+    const bool square = expand_shape_ == ExpandShape::Square;
+    /* rows of every slot: the dilated one for the square, radius 0 to n for the diamond */
+    const int radii_count = square ? 1 : n + 1;
+    const size_t ring_size = size_t(slots) * radii_count * w;
+    ws.expand_rows.resize((ring_size + (square ? 3 * (size_t(w) + 2 * n) : 0)) * sizeof(T));
+    ws.expand_nonzero.assign(slots, 0);
+    T *ring = reinterpret_cast<T*>(ws.expand_rows.data());
+    T *scratch = ring + ring_size;
+
+    auto load = [&](int y) {
+        const T *row = reinterpret_cast<const T*>(dst + dst_pitch * y);
+        T *radii = ring + size_t(y % slots) * radii_count * w;
+        bool nonzero = false;
+        for (int x = 0; x < w; ++x) {
+            nonzero |= row[x] != T(0);
+        }
+        ws.expand_nonzero[y % slots] = nonzero;
+        if (!nonzero) {
+            return;
+        }
+        if (square) {
+            dilate_row(radii, row, w, n, scratch);
+            return;
+        }
+        memcpy(radii, row, w * sizeof(T));
+        for (int r = 1; r <= n; ++r) {
+            dilate_row(radii + size_t(r) * w, radii + size_t(r - 1) * w, w);
+        }
+    };
+
+    for (int y = 0; y < std::min(n, h); ++y) {
+        load(y);
+    }
+    for (int y = 0; y < h; ++y) {
+        if (y + n < h) {
+            load(y + n);
+        }
+        T *out = reinterpret_cast<T*>(dst + dst_pitch * y);
+        bool written = false;
+        for (int dy = -n; dy <= n; ++dy) {
+            int sy = y + dy;
+            if (sy < 0 || sy >= h || !ws.expand_nonzero[sy % slots]) {
+                continue;
+            }
+            int radius = square ? 0 : n - std::abs(dy);
+            const T *row = ring + (size_t(sy % slots) * radii_count + radius) * w;
+            if (written) {
+                max_row(out, row, w);
+            } else {
+                memcpy(out, row, w * sizeof(T));
+                written = true;
+            }
+        }
+    }
+}
+
+
+template <typename T>
+void Cleaner<T>::accumulate_areas(uint32_t first_label, uint32_t end_label, Workspace &ws) {
+    /* roots always have the smallest label of their set, so an ascending pass flattens the forest */
+    for (uint32_t label = first_label; label < end_label; ++label) {
+        uint32_t parent = ws.parents[label];
+        if (parent != label) {
+            ws.parents[label] = ws.parents[parent];
+            ws.areas[ws.parents[label]] += ws.areas[label];
+        }
+    }
+}
+
+template <typename T>
+void Cleaner<T>::decide_factors(uint32_t first_label, uint32_t end_label, Workspace &ws) {
+    /* areas of roots become the output factor: 0 to drop, copy_factor to keep, fade multiplier otherwise */
+    for (uint32_t label = first_label; label < end_label; ++label) {
+        if (ws.parents[label] == label) {
+            ws.areas[label] = component_factor(ws.areas[label], !hysteresis_ || ws.seeded[label], ws);
+        }
+    }
+}
+
+template <typename T>
+uint32_t Cleaner<T>::component_factor(size_t pixels_count, bool seeded, Workspace &ws) {
+    ws.white_count += pixels_count;
+    ws.component_count++;
+    ws.largest_component = std::max(ws.largest_component, pixels_count);
+    /* with a fade, exactly length pixels scale by 0 and are gone as well */
+    if (pixels_count < length_ || !seeded || (pixels_count == length_ && fade_ > 0)) {
+        ws.removed_count += pixels_count;
+        return 0;
+    }
+    /* n == fade scales by 1, so it's copied too and multipliers always fit 32 bits */
+    if (pixels_count - length_ >= fade_) {
+        ws.kept_count += pixels_count;
+        return copy_factor;
+    }
+    return fade_multiplier(pixels_count - length_, fade_);
+}
+
+template <typename T>
+template <int connectivity>
+void Cleaner<T>::clear_mask_runs(uint8_t *dst, const uint8_t *src, int w, int h, int src_pitch, int dst_pitch, Workspace &ws) {
+    uint32_t next_label = 1;
+    ws.runs.clear();
+    ws.row_runs.resize(ws.height + 1);
+    ws.reserve_labels(max_labels(ws.width, ws.height, connectivity));
+
+    /* first pass: extract runs and merge them with the touching runs of the previous row */
+    size_t prev_begin = 0;
+    for (int y = 0; y < h; ++y) {
+        const uint64_t *white_row = ws.white.data() + ws.bitmap_stride * y;
+        size_t row_begin = ws.runs.size();
+        size_t prev = prev_begin;
+        ws.row_runs[y] = row_begin;
+
+        for (int start = find_set_bit(white_row, 0, ws.bitmap_stride); start < w; ) {
+            int end = find_clear_bit(white_row, start, ws.bitmap_stride);
+
+            /* runs touch when [start - 1, end + 1) overlaps them with 8-connectivity, [start, end) with 4 */
+            const int reach = connectivity == 8 ? 1 : 0;
+            while (prev < row_begin && ws.runs[prev].end + reach <= start) {
+                ++prev;
+            }
+            uint32_t label = 0;
+            for (size_t i = prev; i < row_begin && ws.runs[i].start < end + reach; ++i) {
+                label = label ? ws.merge(label, ws.runs[i].label) : ws.runs[i].label;
+            }
+            if (!label) {
+                label = next_label++;
+                ws.parents[label] = label;
+                ws.areas[label] = 0;
+            }
+            ws.areas[label] += end - start;
+
+            Run run = { start, end, label };
+            ws.runs.push_back(run);
+            start = find_set_bit(white_row, end, ws.bitmap_stride);
+        }
+        prev_begin = row_begin;
+    }
+    ws.row_runs[h] = ws.runs.size();
+
+    accumulate_areas(1, next_label, ws);
+    if (hysteresis_) {
+        /* runs are labeled directly, a run is seeded if any of its pixels is */
+        ws.seeded.assign(next_label, 0);
+        for (int y = 0; y < h; ++y) {
+            const uint64_t *seed_row = ws.seeds.data() + ws.bitmap_stride * y;
+            for (size_t i = ws.row_runs[y]; i < ws.row_runs[y + 1]; ++i) {
+                const Run &run = ws.runs[i];
+                if (find_set_bit(seed_row, run.start, ws.bitmap_stride) < run.end) {
+                    ws.seeded[ws.parents[run.label]] = 1;
+                }
+            }
+        }
+    }
+    decide_factors(1, next_label, ws);
+
+    /* second pass: write whole rows, either from the thresholded source erasing runs that aren't
+       kept, or copying kept runs and clearing everything else */
+    bool erase = erase_output(ws);
+    if (erase) {
+        threshold_copy_(dst, dst_pitch, src, src_pitch, w, h, thresh_);
+    }
+    for (int y = 0; y < h; ++y) {
+        const T *src_row = reinterpret_cast<const T*>(src + src_pitch * y);
+        T *dst_row = reinterpret_cast<T*>(dst + dst_pitch * y);
+        int x = 0;
+
+        if (erase) {
+            for (size_t i = ws.row_runs[y]; i < ws.row_runs[y + 1]; ++i) {
+                const Run &run = ws.runs[i];
+                uint32_t factor = ws.areas[ws.parents[run.label]];
+                if (factor != copy_factor) {
+                    write_run(dst_row, src_row, run.start, run.end, factor);
+                }
+            }
+            continue;
+        }
+        for (size_t i = ws.row_runs[y]; i < ws.row_runs[y + 1]; ++i) {
+            const Run &run = ws.runs[i];
+            memset(dst_row + x, 0, (run.start - x) * sizeof(T));
+            write_run(dst_row, src_row, run.start, run.end, ws.areas[ws.parents[run.label]]);
+            x = run.end;
+        }
+        memset(dst_row + x, 0, (w - x) * sizeof(T));
+    }
+}
+
+template class Cleaner<uint8_t>;
+template class Cleaner<uint16_t>;
+template class Cleaner<float>;
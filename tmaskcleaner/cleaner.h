@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include "bitmap.h"
+#include "frame_cache.h"
+#include "hash.h"
+#include "stats.h"
+#include "workspace.h"
+#include "thread_pool.h"
+#include "tuner.h"
+
+/* kernel of the expand parameter */
+enum class ExpandShape {
+    Square,
+    Diamond
+};
+
+/* what a plane turns into when that's known without labeling it */
+enum class PlaneResult {
+    Mixed,
+    Black,
+    Source
+};
+
+/* instruction sets the kernels may use */
+static const int cpu_sse2 = 1;
+static const int cpu_avx2 = 2;
+
+/* instruction sets supported by both the cpu and the os */
+int cpu_features();
+
+/* error message for invalid parameters, nullptr if they are fine */
+const char *check_parameters(int length, int thresh, int thresh_high, int fade, int connectivity, int temporal, int threads, int expand);
+
+/* engine of a name of the engine parameter: auto, floodfill, unionfind or runs; false if unknown */
+bool parse_engine(const char *name, Engine &engine);
+const char *engine_name(Engine engine);
+
+/* shape of a name of the expand_shape parameter: square or diamond; false if unknown */
+bool parse_expand_shape(const char *name, ExpandShape &shape);
+
+/* The platform independent part of the filter, shared by the AviSynth and VapourSynth plugins.
+   Instantiated for uint8_t, uint16_t (10 to 16 bit) and float planes. thresh is always given
+   on the 8 bit scale and converted to the sample range of bits. With thresh_high above thresh,
+   components grow over pixels >= thresh but are only kept if one of them reaches thresh_high.
+   connectivity is 4 or 8, every engine is specialised for both. A temporal radius above 0
+   sizes the cache of thresholded neighbour planes used by clear_mask_temporal. engine only applies
+   to planes labeled on a single thread; temporal planes and planes split over the thread pool have
+   their own labeling. expand above 0 grows what's kept by that many pixels, like as many passes of
+   mt_expand with the square or the diamond shaped kernel. */
+template <typename T>
+class Cleaner {
+public:
+    Cleaner(int width, int height, int length, int thresh, int thresh_high, int fade, int connectivity, int temporal, int threads, int bits, int cpu, Engine engine = Engine::UnionFind,
+        int expand = 0, ExpandShape expand_shape = ExpandShape::Square);
+
+    /* cleans a plane of at most width x height pixels with pitches in bytes, safe to call from several threads;
+       what was found is added to stats if given */
+    void clear_mask(uint8_t *dst, const uint8_t *src, int width, int height, int src_pitch, int dst_pitch, MaskStats *stats = nullptr);
+
+    /* Black if nothing of the plane can be kept, Source if the whole plane is one component that is
+       copied, Mixed if it has to be cleaned; stats of Black and Source planes are added to stats */
+    PlaneResult classify_plane(const uint8_t *src, int width, int height, int src_pitch, MaskStats *stats = nullptr) const;
+
+    /* thresholded plane of a frame if it's still cached, plane is an index chosen by the caller */
+    std::shared_ptr<const ThresholdedPlane> cached_plane(int frame, int plane);
+    /* thresholds a plane of a frame and caches it */
+    std::shared_ptr<const ThresholdedPlane> threshold_plane(int frame, int plane, const uint8_t *src, int width, int height, int src_pitch);
+    /* caches a plane that classify_plane found Black, so neighbours don't request it again */
+    void cache_black_plane(int frame, int plane, int width, int height);
+    /* like clear_mask, but components also have to overlap white pixels in every neighbouring frame;
+       current is the thresholded src */
+    void clear_mask_temporal(uint8_t *dst, const uint8_t *src, int width, int height, int src_pitch, int dst_pitch,
+        const ThresholdedPlane &current, const ThresholdedPlane *const *neighbours, int neighbour_count, MaskStats *stats = nullptr);
+
+    /* hash of a plane of width x height samples, chained through seed to hash several planes */
+    uint64_t hash_plane(const uint8_t *src, int width, int height, int src_pitch, uint64_t seed) const {
+        return hash_(src, src_pitch, width * int(sizeof(T)), height, seed);
+    }
+
+    /* engine used for the following planes, Engine::Auto while it's still being chosen */
+    Engine engine() const {
+        return engine_ == Engine::Auto ? tuner_.chosen() : engine_;
+    }
+
+    /* scratch memory held by idle workspaces */
+    size_t workspace_memory() {
+        return workspaces_.memory();
+    }
+
+private:
+    unsigned int length_;
+    T thresh_;
+    /* thresh is above the largest sample value, so the mask is always empty */
+    bool never_white_;
+    T thresh_high_;
+    bool never_seed_;
+    unsigned int fade_;
+    /* thresh_high is above thresh, so components need a seed to be kept */
+    bool hysteresis_;
+    int connectivity_;
+    int temporal_;
+    int expand_;
+    ExpandShape expand_shape_;
+    Engine engine_;
+    EngineTuner tuner_;
+    typename ScanFunction<T>::type scan_;
+    typename ThresholdFunction<T>::type threshold_;
+    typename ThresholdCopyFunction<T>::type threshold_copy_;
+    typename FadeFunction<T>::type fade_pixels_;
+    HashFunction hash_;
+    WorkspacePool workspaces_;
+    std::unique_ptr<ThreadPool> pool_;
+    FrameCache frames_;
+
+    /* returns the name of the labeling used */
+    template <int connectivity>
+    const char *clear_mask(uint8_t *dst, const uint8_t *src, int width, int height, int src_pitch, int dst_pitch, Workspace &ws);
+    template <int connectivity>
+    void clear_mask_flood_fill(uint8_t *dst, const uint8_t *src, int width, int height, int src_pitch, int dst_pitch, Workspace &ws);
+    template <int connectivity>
+    void clear_mask_union_find(uint8_t *dst, const uint8_t *src, int width, int height, int src_pitch, int dst_pitch, Workspace &ws);
+    template <int connectivity>
+    void clear_mask_parallel(uint8_t *dst, const uint8_t *src, int width, int height, int src_pitch, int dst_pitch, Workspace &ws);
+    template <int connectivity>
+    void clear_mask_temporal(uint8_t *dst, const uint8_t *src, int width, int height, int src_pitch, int dst_pitch,
+        const ThresholdedPlane &current, const ThresholdedPlane *const *neighbours, int neighbour_count, Workspace &ws);
+    template <int connectivity>
+    void clear_mask_runs(uint8_t *dst, const uint8_t *src, int width, int height, int src_pitch, int dst_pitch, Workspace &ws);
+    void threshold_rows(const uint8_t *src, int src_pitch, int width, int y_begin, int y_end, Workspace &ws);
+    void threshold_seeds(const uint8_t *src, int src_pitch, int width, int y_begin, int y_end, Workspace &ws);
+    void mark_seeds(int width, int height, uint32_t label_count, Workspace &ws);
+    template <int connectivity>
+    uint32_t label_rows(int width, int y_begin, int y_end, uint32_t next_label, Workspace &ws);
+    void write_rows(uint8_t *dst, const uint8_t *src, int width, int y_begin, int y_end, int src_pitch, int dst_pitch, Workspace &ws);
+    void erase_rows(uint8_t *dst, const uint8_t *src, int width, int y_begin, int y_end, int src_pitch, int dst_pitch, Workspace &ws);
+    void accumulate_areas(uint32_t first_label, uint32_t end_label, Workspace &ws);
+    void decide_factors(uint32_t first_label, uint32_t end_label, Workspace &ws);
+    uint32_t component_factor(size_t pixels_count, bool seeded, Workspace &ws);
+    template <int connectivity>
+    size_t process_pixel(uint32_t bit, size_t copy_length, bool &seeded, Workspace &ws);
+    void expand_plane(uint8_t *dst, int width, int height, int dst_pitch, Workspace &ws);
+    void write_run(T *dst_row, const T *src_row, int start, int end, uint32_t factor);
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* white pixels of one plane of one frame, in the layout of Workspace::white */
+struct ThresholdedPlane {
+    int width;
+    int height;
+    int bitmap_stride;
+    std::vector<uint64_t> white;
+};
+
+/* The least recently used planes of the temporal mode, keyed by frame number and plane. With
+   sequential access every source frame is thresholded once instead of once per frame it's a
+   neighbour of. */
+class FrameCache {
+public:
+    FrameCache(size_t capacity) : capacity_(capacity) {}
+
+    std::shared_ptr<const ThresholdedPlane> find(int frame, int plane) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if (it->frame == frame && it->plane == plane) {
+                entries_.splice(entries_.begin(), entries_, it);
+                return it->data;
+            }
+        }
+        return nullptr;
+    }
+
+    void insert(int frame, int plane, std::shared_ptr<const ThresholdedPlane> data) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        /* another thread may have thresholded the same plane in the meantime */
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if (it->frame == frame && it->plane == plane) {
+                return;
+            }
+        }
+        Entry entry = { frame, plane, data };
+        entries_.push_front(entry);
+        if (entries_.size() > capacity_) {
+            entries_.pop_back();
+        }
+    }
+
+private:
+    struct Entry {
+        int frame;
+        int plane;
+        std::shared_ptr<const ThresholdedPlane> data;
+    };
+
+    size_t capacity_;
+    std::mutex mutex_;
+    std::list<Entry> entries_;
+};
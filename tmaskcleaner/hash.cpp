@@ -0,0 +1,130 @@
+#include "hash.h"
+#include <string.h>
+#ifdef TMC_X86
+#include <emmintrin.h>
+#endif
+
+static const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+
+/* rows are hashed in 64 byte blocks, each 16 byte part has its own pair of accumulators and keys */
+static const uint64_t keys[8] = {
+    0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+    0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL,
+};
+
+static inline uint64_t rotate_left(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/* like the XXH3 accumulator: each word adds the product of the halves of word ^ key and the other word */
+static inline void accumulate(uint64_t *acc, const uint8_t *src, const uint64_t *key) {
+    uint64_t words[2];
+    memcpy(words, src, sizeof(words));
+    uint64_t mixed0 = words[0] ^ key[0];
+    uint64_t mixed1 = words[1] ^ key[1];
+    acc[0] += (mixed0 & 0xFFFFFFFF) * (mixed0 >> 32) + words[1];
+    acc[1] += (mixed1 & 0xFFFFFFFF) * (mixed1 >> 32) + words[0];
+}
+
+/* a sum of blocks doesn't depend on their order, so the accumulators are scrambled after every row */
+static inline void scramble(uint64_t *acc) {
+    for (int i = 0; i < 8; ++i) {
+        acc[i] = (acc[i] ^ (acc[i] >> 47)) * prime1;
+    }
+}
+
+static inline void start(uint64_t *acc, uint64_t seed) {
+    for (int i = 0; i < 8; ++i) {
+        acc[i] = seed + keys[i];
+    }
+}
+
+static inline uint64_t finish(const uint64_t *acc, int row_size, int height) {
+    uint64_t hash = prime4 + uint64_t(row_size) * prime3 + uint64_t(height) * prime2;
+    for (int i = 0; i < 8; ++i) {
+        hash ^= rotate_left(acc[i] * prime2, 31) * prime1;
+        hash = rotate_left(hash, 27) * prime1 + prime4;
+    }
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t hash_plane_c(const uint8_t *src, int src_pitch, int row_size, int height, uint64_t seed) {
+    uint64_t acc[8];
+    start(acc, seed);
+
+    for (int y = 0; y < height; ++y) {
+        int x = 0;
+        for (; x + 64 <= row_size; x += 64) {
+            for (int i = 0; i < 4; ++i) {
+                accumulate(acc + 2 * i, src + x + 16 * i, keys + 2 * i);
+            }
+        }
+        for (; x + 16 <= row_size; x += 16) {
+            accumulate(acc, src + x, keys);
+        }
+        if (x < row_size) {
+            uint8_t tail[16] = { 0 };
+            memcpy(tail, src + x, row_size - x);
+            accumulate(acc, tail, keys);
+        }
+        scramble(acc);
+        src += src_pitch;
+    }
+    return finish(acc, row_size, height);
+}
+
+#ifdef TMC_X86
+static inline __m128i accumulate_sse2(__m128i acc, __m128i words, __m128i key) {
+    __m128i mixed = _mm_xor_si128(words, key);
+    /* mul_epu32 multiplies the low halves, so the high halves are moved down first */
+    __m128i product = _mm_mul_epu32(mixed, _mm_shuffle_epi32(mixed, _MM_SHUFFLE(2, 3, 0, 1)));
+    __m128i swapped = _mm_shuffle_epi32(words, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm_add_epi64(acc, _mm_add_epi64(product, swapped));
+}
+
+uint64_t hash_plane_sse2(const uint8_t *src, int src_pitch, int row_size, int height, uint64_t seed) {
+    uint64_t acc[8];
+    start(acc, seed);
+    __m128i key[4];
+    for (int i = 0; i < 4; ++i) {
+        key[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + 2 * i));
+    }
+
+    for (int y = 0; y < height; ++y) {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + 2));
+        __m128i a2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + 4));
+        __m128i a3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + 6));
+        int x = 0;
+        for (; x + 64 <= row_size; x += 64) {
+            a0 = accumulate_sse2(a0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x)), key[0]);
+            a1 = accumulate_sse2(a1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + 16)), key[1]);
+            a2 = accumulate_sse2(a2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + 32)), key[2]);
+            a3 = accumulate_sse2(a3, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + 48)), key[3]);
+        }
+        for (; x + 16 <= row_size; x += 16) {
+            a0 = accumulate_sse2(a0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x)), key[0]);
+        }
+        if (x < row_size) {
+            uint8_t tail[16] = { 0 };
+            memcpy(tail, src + x, row_size - x);
+            a0 = accumulate_sse2(a0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(tail)), key[0]);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc), a0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + 2), a1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + 4), a2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + 6), a3);
+        scramble(acc);
+        src += src_pitch;
+    }
+    return finish(acc, row_size, height);
+}
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+#include "bitmap.h"
+
+/* Hash of row_size bytes of every row of a plane, chained through seed. Only used to find
+   candidates for duplicate frames, which are confirmed by comparing the planes, so it's built
+   for speed rather than strength. The C and SSE2 kernels give identical results. */
+typedef uint64_t (*HashFunction)(const uint8_t *src, int src_pitch, int row_size, int height, uint64_t seed);
+
+uint64_t hash_plane_c(const uint8_t *src, int src_pitch, int row_size, int height, uint64_t seed);
+#ifdef TMC_X86
+uint64_t hash_plane_sse2(const uint8_t *src, int src_pitch, int row_size, int height, uint64_t seed);
+#endif
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Computes the frames after the last request on a background thread, so a host asking for
+   frames one at a time finds the next ones done. Only the thread making requests talks to the
+   host: schedule gathers a Job for every frame with prepare(n), and the worker runs compute(n, job)
+   on what's gathered and nothing else. Jobs are kept with their result, so the host's handles are
+   also released on the requesting thread. Requests that don't continue the sequence drop what was
+   computed ahead of the previous one, except frames the host announced with prefetch. What
+   prepare or compute throw is rethrown by the take of that frame. */
+template <typename Frame, typename Job>
+class Lookahead {
+public:
+    typedef std::function<Job(int)> Prepare;
+    typedef std::function<Frame(int, Job&)> Compute;
+
+    Lookahead(int depth, int num_frames, const Compute &compute)
+        : depth_(depth), num_frames_(num_frames), compute_(compute), busy_(-1), busy_prefetched_(false), stop_(false),
+          worker_(&Lookahead::work, this) {}
+
+    ~Lookahead() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        worker_.join();
+    }
+
+    /* frame n if it was computed ahead, waiting for it if the worker is on it right now; false if
+       the caller has to compute it itself */
+    bool take(int n, Frame &frame) {
+        Result result;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            /* the caller computes a frame that wasn't started, so the worker doesn't have to */
+            for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+                if (it->n == n) {
+                    queue_.erase(it);
+                    break;
+                }
+            }
+            hinted_.erase(std::remove(hinted_.begin(), hinted_.end(), n), hinted_.end());
+            done_.wait(lock, [this, n] { return busy_ != n; });
+            auto it = ready_.find(n);
+            if (it == ready_.end()) {
+                return false;
+            }
+            result = it->second;
+            ready_.erase(it);
+        }
+        if (result.error) {
+            std::rethrow_exception(result.error);
+        }
+        frame = result.frame;
+        return true;
+    }
+
+    /* prepares and queues the frames announced since the last call and the frames after n that
+       aren't computed yet, and forgets the sequential ones outside that window */
+    void schedule(int n, const Prepare &prepare) {
+        std::vector<Entry> wanted;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto it = ready_.begin(); it != ready_.end(); ) {
+                if (!it->second.prefetched && (it->first <= n || it->first > n + depth_)) {
+                    it = ready_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            for (auto it = queue_.begin(); it != queue_.end(); ) {
+                if (!it->prefetched && (it->n <= n || it->n > n + depth_)) {
+                    it = queue_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            for (size_t i = 0; i < hinted_.size(); ++i) {
+                if (!pending(hinted_[i])) {
+                    wanted.push_back(Entry(hinted_[i], true));
+                }
+            }
+            hinted_.clear();
+            for (int k = n + 1; k <= std::min(n + depth_, num_frames_ - 1); ++k) {
+                if (!pending(k)) {
+                    wanted.push_back(Entry(k, false));
+                }
+            }
+        }
+        /* preparing calls into the host, so it runs unlocked while the worker keeps going */
+        for (size_t i = 0; i < wanted.size(); ++i) {
+            Entry &entry = wanted[i];
+            try {
+                entry.job = prepare(entry.n);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ready_[entry.n] = Result(entry.prefetched, std::current_exception());
+                continue;
+            }
+            /* swapped in, a job must not be shared once the worker can see it */
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (entry.prefetched) {
+                    queue_.push_front(Entry(entry.n, true));
+                    std::swap(queue_.front().job, entry.job);
+                } else {
+                    queue_.push_back(Entry(entry.n, false));
+                    std::swap(queue_.back().job, entry.job);
+                }
+            }
+            wake_.notify_one();
+        }
+    }
+
+    /* a frame the host announced; it's prepared by the next schedule and kept until it's taken,
+       at most depth of them at a time */
+    void prefetch(int n) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (n < 0 || n >= num_frames_ || pending(n) || std::find(hinted_.begin(), hinted_.end(), n) != hinted_.end()
+            || prefetched_count() >= depth_) {
+            return;
+        }
+        hinted_.push_back(n);
+    }
+
+private:
+    struct Entry {
+        int n;
+        bool prefetched;
+        Job job;
+
+        Entry() : n(-1), prefetched(false) {}
+        Entry(int n, bool prefetched) : n(n), prefetched(prefetched) {}
+    };
+
+    struct Result {
+        bool prefetched;
+        Frame frame;
+        std::exception_ptr error;
+        Job job;
+
+        Result() : prefetched(false) {}
+        Result(bool prefetched, std::exception_ptr error) : prefetched(prefetched), error(error) {}
+    };
+
+    int depth_;
+    int num_frames_;
+    Compute compute_;
+    std::deque<Entry> queue_;
+    std::map<int, Result> ready_;
+    /* frames announced by prefetch that aren't prepared yet */
+    std::vector<int> hinted_;
+    /* frame the worker is computing, -1 if none */
+    int busy_;
+    bool busy_prefetched_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    /* started last, once everything it uses is constructed */
+    std::thread worker_;
+
+    /* frame is queued, being computed or done; called locked */
+    bool pending(int n) const {
+        if (n == busy_ || ready_.find(n) != ready_.end()) {
+            return true;
+        }
+        for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+            if (it->n == n) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int prefetched_count() const {
+        int count = int(hinted_.size()) + (busy_ >= 0 && busy_prefetched_ ? 1 : 0);
+        for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+            count += it->prefetched ? 1 : 0;
+        }
+        for (auto it = ready_.begin(); it != ready_.end(); ++it) {
+            count += it->second.prefetched ? 1 : 0;
+        }
+        return count;
+    }
+
+    void work() {
+        for (;;) {
+            Entry entry;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+                if (stop_) {
+                    return;
+                }
+                entry = queue_.front();
+                queue_.pop_front();
+                busy_ = entry.n;
+                busy_prefetched_ = entry.prefetched;
+            }
+            Result result(entry.prefetched, std::exception_ptr());
+            try {
+                result.frame = compute_(entry.n, entry.job);
+            } catch (...) {
+                result.error = std::current_exception();
+            }
+            /* the worker lets go of its handles before the result is published, so the last one
+               is always released by the requesting thread */
+            result.job = entry.job;
+            entry.job = Job();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                busy_ = -1;
+                std::swap(ready_[entry.n], result);
+            }
+            done_.notify_all();
+        }
+    }
+
+    Lookahead(const Lookahead&);
+    Lookahead &operator=(const Lookahead&);
+};
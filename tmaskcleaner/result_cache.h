@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <list>
+#include <mutex>
+#include <vector>
+
+/* duplicates are usually runs of consecutive frames, the rest covers frames in flight on other threads */
+static const size_t result_cache_size = 4;
+
+/* The last few source frames and the frames produced from them, keyed by a hash of the source.
+   Frame is a reference counted handle of the host, so a hit hands out the earlier result without
+   copying it. Hashes can collide, so callers compare the sources of the candidates. */
+template <typename Frame>
+class ResultCache {
+public:
+    struct Entry {
+        uint64_t hash;
+        Frame src;
+        Frame dst;
+    };
+
+    ResultCache(size_t capacity) : capacity_(capacity) {}
+
+    /* entries with this hash, most recent first; copied out so the comparison runs unlocked */
+    std::vector<Entry> find(uint64_t hash) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Entry> candidates;
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if (it->hash == hash) {
+                candidates.push_back(*it);
+            }
+        }
+        return candidates;
+    }
+
+    void insert(uint64_t hash, const Frame &src, const Frame &dst) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry entry = { hash, src, dst };
+        entries_.push_front(entry);
+        if (entries_.size() > capacity_) {
+            entries_.pop_back();
+        }
+    }
+
+private:
+    size_t capacity_;
+    std::mutex mutex_;
+    std::list<Entry> entries_;
+};
@@ -0,0 +1,51 @@
+#include "stats.h"
+#include <algorithm>
+
+/* nearest rank percentile of sorted times */
+static double percentile(const std::vector<double> &sorted, double p) {
+    size_t rank = size_t(p * sorted.size() + 0.999999);
+    return sorted[std::max(rank, size_t(1)) - 1];
+}
+
+StatsLog::StatsLog(const char *path) : file_(fopen(path, "w")), pixels_(0) {
+    if (file_) {
+        fprintf(file_, "frame,ms,cached,white,components,largest,kept,removed,peak_queue,engine\n");
+    }
+}
+
+StatsLog::~StatsLog() {
+    if (!file_) {
+        return;
+    }
+    if (!times_.empty()) {
+        std::vector<double> sorted(times_);
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0;
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            total += sorted[i];
+        }
+        /* frames run concurrently, so fps is over wall clock time while Mpix/s is per thread */
+        double wall = std::chrono::duration<double>(last_ - first_).count();
+        fprintf(file_, "# frames %u, ms p50 %.3f, p99 %.3f, max %.3f, mean %.3f\n", unsigned(sorted.size()),
+            percentile(sorted, 0.5), percentile(sorted, 0.99), sorted.back(), total / sorted.size());
+        fprintf(file_, "# %.2f fps, %.1f Mpix/s\n", wall > 0 ? sorted.size() / wall : 0.0, total > 0 ? pixels_ / total / 1e3 : 0.0);
+    }
+    fclose(file_);
+}
+
+void StatsLog::record(int frame, Clock::time_point start, bool cached, const MaskStats &stats, size_t pixels) {
+    Clock::time_point end = Clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (times_.empty() || start < first_) {
+        first_ = start;
+    }
+    if (times_.empty() || end > last_) {
+        last_ = end;
+    }
+    times_.push_back(ms);
+    pixels_ += pixels;
+    fprintf(file_, "%d,%.3f,%d,%u,%u,%u,%u,%u,%u,%s\n", frame, ms, cached ? 1 : 0, unsigned(stats.white), unsigned(stats.components),
+        unsigned(stats.largest), unsigned(stats.white - stats.removed), unsigned(stats.removed), unsigned(stats.peak_queue), stats.engine ? stats.engine : "none");
+}
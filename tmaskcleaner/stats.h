@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+/* what clear_mask found in the planes of a frame; counts are summed over planes, sizes are maxima */
+struct MaskStats {
+    size_t white;
+    size_t components;
+    size_t largest;
+    size_t removed;
+    /* most pixels waiting in the flood fill queue at once, 0 for the other engines */
+    size_t peak_queue;
+    /* labeling the planes went through: an engine name, parallel, temporal or mixed if planes
+       differ; nullptr if none was labeled */
+    const char *engine;
+};
+
+/* Per-frame CSV log of the stats parameter. Lines are written as frames finish, so with several
+   threads they aren't in frame order. A summary of the frame times is appended as # comments when
+   the log is destroyed with the filter. */
+class StatsLog {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /* check is_open, nothing is written otherwise */
+    explicit StatsLog(const char *path);
+    ~StatsLog();
+
+    bool is_open() const {
+        return file_ != nullptr;
+    }
+
+    /* cached frames were shared with an identical earlier source and have no mask stats */
+    void record(int frame, Clock::time_point start, bool cached, const MaskStats &stats, size_t pixels);
+
+private:
+    FILE *file_;
+    std::mutex mutex_;
+    std::vector<double> times_;
+    uint64_t pixels_;
+    Clock::time_point first_;
+    Clock::time_point last_;
+
+    StatsLog(const StatsLog&);
+    StatsLog &operator=(const StatsLog&);
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fixed set of worker threads running parallel_for jobs. Several threads may submit jobs at
+   the same time; the submitting thread always works on its own job too, so a pool of
+   threads - 1 workers keeps threads cores busy. */
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads) : stop_(false) {
+        for (int i = 1; i < threads; ++i) {
+            workers_.push_back(std::thread(&ThreadPool::work, this));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    int size() const {
+        return int(workers_.size()) + 1;
+    }
+
+    /* calls fn(0) .. fn(count - 1) and returns once all of them have finished */
+    void parallel_for(int count, const std::function<void(int)> &fn) {
+        if (count <= 0) {
+            return;
+        }
+        Job job(fn, count);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(&job);
+        }
+        wake_.notify_all();
+
+        int index;
+        while ((index = claim(&job)) >= 0) {
+            run(&job, index);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [&job] { return job.finished == job.count; });
+    }
+
+private:
+    struct Job {
+        Job(const std::function<void(int)> &fn, int count) : fn(fn), count(count), next(0), finished(0) {}
+
+        const std::function<void(int)> &fn;
+        int count;
+        int next;
+        int finished;
+    };
+
+    std::vector<std::thread> workers_;
+    std::deque<Job*> jobs_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    bool stop_;
+
+    /* next index of the job, or -1 once all indices are handed out */
+    int claim(Job *job) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (job->next == job->count) {
+            return -1;
+        }
+        int index = job->next++;
+        if (job->next == job->count) {
+            jobs_.erase(std::find(jobs_.begin(), jobs_.end(), job));
+        }
+        return index;
+    }
+
+    void run(Job *job, int index) {
+        job->fn(index);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (++job->finished == job->count) {
+            done_.notify_all();
+        }
+    }
+
+    void work() {
+        for (;;) {
+            Job *job;
+            int index;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+                if (stop_) {
+                    return;
+                }
+                job = jobs_.front();
+                index = job->next++;
+                if (job->next == job->count) {
+                    jobs_.pop_front();
+                }
+            }
+            run(job, index);
+        }
+    }
+};
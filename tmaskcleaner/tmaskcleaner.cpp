@@ -1,143 +1,430 @@
+#ifdef _WIN32
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
-#include <vector>
 #pragma warning(disable: 4512 4244 4100)
 #include "avisynth.h"
 #pragma warning(default: 4512 4244 4100)
+#define PLUGIN_EXPORT __declspec(dllexport)
+#else
+/* AviSynth+ headers of the system, the bundled avisynth.h is the Windows-only 2.6 one */
+#include <avisynth.h>
+#define PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
 #include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "cleaner.h"
+#include "lookahead.h"
+#include "result_cache.h"
+
+/* what happens to a plane, numbered like the masktools plane modes */
+enum class PlaneMode {
+    Leave = 1,
+    Copy = 2,
+    Process = 3
+};
+
+/* AviSynth+ extensions of the CPUF_ flags and cache hints */
+static const long cpuf_avx2 = 0x2000;
+static const int cache_get_mtmode = 509;
+static const int mt_nice_filter = 1;
+static const int mt_serialized = 3;
 
-typedef std::pair<int, int> Coordinates;
+/* bits per sample of a planar format, including the AviSynth+ 10, 12 and 14 bit ones; 0 if unsupported */
+static int bits_per_sample(const VideoInfo &vi) {
+    switch ((vi.pixel_type & VideoInfo::CS_Sample_Bits_Mask) >> VideoInfo::CS_Shift_Sample_Bits) {
+    case 0: return 8;
+    case 1: return 16;
+    case 2: return 32;
+    case 5: return 10;
+    case 6: return 12;
+    case 7: return 14;
+    default: return 0;
+    }
+}
 
+static int avs_cpu_features(IScriptEnvironment *env) {
+    long cpu = env->GetCPUFlags();
+    return (cpu & CPUF_SSE2 ? cpu_sse2 : 0) | (cpu & cpuf_avx2 ? cpu_avx2 : 0);
+}
+
+template <typename T>
 class TMaskCleaner : public GenericVideoFilter {
 public:
-    TMaskCleaner(PClip child, int length, int thresh, int fade, IScriptEnvironment*);
+    TMaskCleaner(PClip child, int length, int thresh, int thresh_high, int fade, int connectivity, int temporal, int threads, int bits, const char *planes, const char *stats, int lookahead, Engine engine, int expand, ExpandShape expand_shape, IScriptEnvironment*);
     PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
 
-    ~TMaskCleaner() {
-        delete[] lookup_;
+    int __stdcall SetCacheHints(int cachehints, int frame_range) {
+        switch (cachehints) {
+        /* the lookahead follows a single sequence of requests and prepares frames with the env of the request */
+        case CACHE_GETCHILD_THREAD_MODE:
+            return lookahead_ ? CACHE_THREAD_UNSAFE : CACHE_THREAD_SAFE;
+        case cache_get_mtmode:
+            return lookahead_ ? mt_serialized : mt_nice_filter;
+        /* in temporal mode the neighbours are requested together, so ask for the same window as of the child */
+        case CACHE_GETCHILD_CACHE_MODE:
+            return temporal_ > 0 ? CACHE_WINDOW : CACHE_GENERIC;
+        case CACHE_GETCHILD_CACHE_SIZE:
+            return temporal_ > 0 ? temporal_ + 1 : 0;
+        case CACHE_GETCHILD_COST:
+            return CACHE_COST_MED;
+        case CACHE_PREFETCH_FRAME:
+            if (lookahead_) {
+                lookahead_->prefetch(frame_range);
+            }
+            return 0;
+        default:
+            return 0;
+        }
     }
 private:
-    unsigned int length_;
-    unsigned int thresh_;
-    unsigned int fade_;
-    uint8_t *lookup_;
-    int width_;
-
-    void clear_mask(uint8_t *dst, const uint8_t *src, int width, int height, int src_pitch, int dst_pitch);
-    void process_pixel(const uint8_t *src, int x, int y, int pitch, int w, int h, std::vector<Coordinates> &coordinates, std::vector<Coordinates> &white_pixels);
+    /* what cleaning frame n takes from AviSynth: the frames of its temporal window, starting at
+       first, and the output frame; entries left null are requested while cleaning */
+    struct Sources {
+        int first;
+        std::vector<PVideoFrame> frames;
+        PVideoFrame dst;
+    };
 
-    bool is_white(uint8_t value) {
-        return value >= thresh_;
-    }
+    Cleaner<T> cleaner_;
+    int plane_count_;
+    int plane_ids_[3];
+    PlaneMode plane_modes_[3];
+    /* no plane is processed or left alone, so frames are passed through untouched */
+    bool passthrough_;
+    int temporal_;
+    /* results of identical source frames are shared, but not in temporal mode where the neighbours count too */
+    ResultCache<PVideoFrame> results_;
+    /* only created with the stats parameter */
+    std::unique_ptr<StatsLog> stats_;
+    /* returned for every frame whose processed planes all end up empty, unless some plane is copied */
+    PVideoFrame black_;
+    /* declared last, so the worker stops before anything it uses is destroyed */
+    std::unique_ptr<Lookahead<PVideoFrame, Sources>> lookahead_;
 
-    bool visited(int x, int y) {
-        unsigned int normal_pos = y * width_ + x;
-        unsigned int byte_pos = normal_pos / 8;
+    Sources fetch_sources(int n, bool everything, IScriptEnvironment* env);
+    /* env is null on the lookahead worker, which gets everything fetched in advance */
+    PVideoFrame clean_frame(int n, Sources &sources, IScriptEnvironment* env);
+    size_t processed_pixels(const PVideoFrame &frame) const;
+    uint64_t hash_frame(const PVideoFrame &frame) const;
+    bool same_source(const PVideoFrame &a, const PVideoFrame &b) const;
+    void clear_plane_temporal(PVideoFrame &dst, std::vector<PVideoFrame> &frames, int n, int first, int i, MaskStats *stats, IScriptEnvironment* env);
+};
 
-        return lookup_[byte_pos] & (1 << (normal_pos - byte_pos*8));
+template <typename T>
+TMaskCleaner<T>::TMaskCleaner(PClip child, int length, int thresh, int thresh_high, int fade, int connectivity, int temporal, int threads, int bits, const char *planes, const char *stats, int lookahead, Engine engine, int expand, ExpandShape expand_shape, IScriptEnvironment* env)
+: GenericVideoFilter(child),
+  cleaner_(child->GetVideoInfo().width, child->GetVideoInfo().height, length, thresh, thresh_high, fade, connectivity, temporal, threads, bits, avs_cpu_features(env), engine, expand, expand_shape),
+  temporal_(temporal), results_(result_cache_size) {
+    if (!vi.IsPlanar()) {
+        env->ThrowError("TMaskCleaner: only planar colorspaces are supported!");
     }
 
-    void visit(int x, int y) {
-        unsigned int normal_pos = y * width_ + x;
-        unsigned int byte_pos = normal_pos / 8;
+    /* greyscale formats are planar and interleaved at the same time */
+    if (vi.pixel_type & VideoInfo::CS_INTERLEAVED) {
+        plane_count_ = 1;
+        plane_ids_[0] = PLANAR_Y;
+    } else if (vi.IsRGB()) {
+        plane_count_ = 3;
+        plane_ids_[0] = PLANAR_G;
+        plane_ids_[1] = PLANAR_B;
+        plane_ids_[2] = PLANAR_R;
+    } else {
+        plane_count_ = 3;
+        plane_ids_[0] = PLANAR_Y;
+        plane_ids_[1] = PLANAR_U;
+        plane_ids_[2] = PLANAR_V;
+    }
+    /* planes missing from the string are left alone, extra ones are ignored for greyscale clips */
+    size_t planes_length = strlen(planes);
+    if (planes_length > 3) {
+        env->ThrowError("TMaskCleaner: planes can't have more than 3 entries.");
+    }
+    passthrough_ = true;
+    for (int i = 0; i < plane_count_; ++i) {
+        char mode = size_t(i) < planes_length ? planes[i] : '1';
+        if (mode < '1' || mode > '3') {
+            env->ThrowError("TMaskCleaner: planes must consist of 1 (leave), 2 (copy) and 3 (process).");
+        }
+        plane_modes_[i] = PlaneMode(mode - '0');
+        passthrough_ = passthrough_ && plane_modes_[i] == PlaneMode::Copy;
+    }
+    if (!passthrough_) {
+        black_ = env->NewVideoFrame(vi);
+        for (int i = 0; i < plane_count_; ++i) {
+            memset(black_->GetWritePtr(plane_ids_[i]), 0, black_->GetPitch(plane_ids_[i]) * black_->GetHeight(plane_ids_[i]));
+        }
+    }
+    if (*stats) {
+        stats_.reset(new StatsLog(stats));
+        if (!stats_->is_open()) {
+            env->ThrowError("TMaskCleaner: can't open the stats file.");
+        }
+    }
+    /* the temporal window is requested around every frame */
+    if (temporal > 0) {
+        child->SetCacheHints(CACHE_WINDOW, temporal + 1);
+    }
+    /* the worker only cleans, every frame it needs is requested by GetFrame */
+    if (lookahead > 0 && !passthrough_) {
+        lookahead_.reset(new Lookahead<PVideoFrame, Sources>(lookahead, vi.num_frames, [this](int n, Sources &sources) {
+            return clean_frame(n, sources, nullptr);
+        }));
+    }
+}
 
-        lookup_[byte_pos] |= (1 << (normal_pos - byte_pos*8));
+template <typename T>
+PVideoFrame TMaskCleaner<T>::GetFrame(int n, IScriptEnvironment* env) {
+    PVideoFrame frame;
+    if (!lookahead_ || !lookahead_->take(n, frame)) {
+        Sources sources = fetch_sources(n, false, env);
+        frame = clean_frame(n, sources, env);
     }
-};
+    if (lookahead_) {
+        lookahead_->schedule(n, [this, env](int k) { return fetch_sources(k, true, env); });
+    }
+    return frame;
+}
 
-TMaskCleaner::TMaskCleaner(PClip child, int length, int thresh, int fade, IScriptEnvironment* env)
-: GenericVideoFilter(child), length_(length), thresh_(thresh), fade_(fade), lookup_(nullptr) {
-    if (!vi.IsPlanar()) {
-        env->ThrowError("TMaskCleaner: only planar colorspaces are supported!");
+/* everything for the lookahead, which can't call into AviSynth, otherwise only the source frame */
+template <typename T>
+typename TMaskCleaner<T>::Sources TMaskCleaner<T>::fetch_sources(int n, bool everything, IScriptEnvironment* env) {
+    Sources sources;
+    sources.first = std::max(n - temporal_, 0);
+    int last = std::min(n + temporal_, vi.num_frames - 1);
+    sources.frames.resize(last - sources.first + 1);
+    for (int k = sources.first; k <= last; ++k) {
+        if (everything || k == n) {
+            sources.frames[k - sources.first] = child->GetFrame(k, env);
+        }
     }
-    if (length <= 0 || thresh <= 0) {
-        env->ThrowError("TMaskCleaner: length and thresh must be greater than zero.");
+    if (everything) {
+        sources.dst = env->NewVideoFrame(vi);
     }
-    if (fade < 0) {
-        env->ThrowError("TMaskCleaner: fade cannot be negative.");
+    return sources;
+}
+
+static void copy_plane(BYTE *dst, int dst_pitch, const BYTE *src, int src_pitch, int row_size, int height) {
+    for (int y = 0; y < height; ++y) {
+        memcpy(dst + dst_pitch * y, src + src_pitch * y, row_size);
     }
-    lookup_ = new uint8_t[child->GetVideoInfo().height * child->GetVideoInfo().width / 8];
-    width_ = child->GetVideoInfo().width;
 }
 
-PVideoFrame TMaskCleaner::GetFrame(int n, IScriptEnvironment* env) {
-    PVideoFrame src = child->GetFrame(n,env);
-    PVideoFrame dst = env->NewVideoFrame(child->GetVideoInfo());
+template <typename T>
+PVideoFrame TMaskCleaner<T>::clean_frame(int n, Sources &sources, IScriptEnvironment* env) {
+    PVideoFrame src = sources.frames[n - sources.first];
+    if (passthrough_) {
+        return src;
+    }
+    /* the time spent in the child isn't counted */
+    StatsLog::Clock::time_point start;
+    MaskStats mask_stats = MaskStats();
+    MaskStats *stats = nullptr;
+    if (stats_) {
+        start = StatsLog::Clock::now();
+        stats = &mask_stats;
+    }
 
-    memset(dst->GetWritePtr(PLANAR_Y), 0, dst->GetPitch(PLANAR_Y) * dst->GetHeight(PLANAR_Y));
-    memset(lookup_, 0, child->GetVideoInfo().height * child->GetVideoInfo().width / 8);
+    /* planes that are empty or a single copied component skip labeling, whole frames of them skip allocating */
+    PlaneResult results[3];
+    bool all_black = true;
+    bool all_source = true;
+    for (int i = 0; i < plane_count_; ++i) {
+        int plane = plane_ids_[i];
+        if (plane_modes_[i] == PlaneMode::Process) {
+            int width = src->GetRowSize(plane) / sizeof(T);
+            results[i] = cleaner_.classify_plane(src->GetReadPtr(plane), width, src->GetHeight(plane), src->GetPitch(plane), stats);
+            if (results[i] == PlaneResult::Black && temporal_ > 0) {
+                cleaner_.cache_black_plane(n, i, width, src->GetHeight(plane));
+            }
+            all_black = all_black && results[i] == PlaneResult::Black;
+            all_source = all_source && results[i] == PlaneResult::Source;
+        } else if (plane_modes_[i] == PlaneMode::Copy) {
+            all_black = false;
+        }
+    }
+    if (all_source || all_black) {
+        if (stats_) {
+            stats_->record(n, start, false, mask_stats, processed_pixels(src));
+        }
+        return all_source ? src : black_;
+    }
+
+    uint64_t hash = 0;
+    if (temporal_ == 0) {
+        hash = hash_frame(src);
+        std::vector<ResultCache<PVideoFrame>::Entry> candidates = results_.find(hash);
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (same_source(candidates[i].src, src)) {
+                if (stats_) {
+                    stats_->record(n, start, true, MaskStats(), processed_pixels(src));
+                }
+                return candidates[i].dst;
+            }
+        }
+    }
+    /* a frame is only writable with a single reference */
+    PVideoFrame dst = sources.dst;
+    sources.dst = nullptr;
+    if (!dst) {
+        dst = env->NewVideoFrame(vi);
+    }
 
-    clear_mask(dst->GetWritePtr(PLANAR_Y), src->GetReadPtr(PLANAR_Y), dst->GetRowSize(PLANAR_Y), dst->GetHeight(PLANAR_Y),src->GetPitch(PLANAR_Y), dst->GetPitch(PLANAR_Y));
+    for (int i = 0; i < plane_count_; ++i) {
+        int plane = plane_ids_[i];
+        switch (plane_modes_[i]) {
+        case PlaneMode::Process:
+            if (results[i] == PlaneResult::Black) {
+                memset(dst->GetWritePtr(plane), 0, dst->GetPitch(plane) * dst->GetHeight(plane));
+            } else if (results[i] == PlaneResult::Source) {
+                copy_plane(dst->GetWritePtr(plane), dst->GetPitch(plane), src->GetReadPtr(plane), src->GetPitch(plane), src->GetRowSize(plane), src->GetHeight(plane));
+            } else if (temporal_ > 0) {
+                clear_plane_temporal(dst, sources.frames, n, sources.first, i, stats, env);
+            } else {
+                cleaner_.clear_mask(dst->GetWritePtr(plane), src->GetReadPtr(plane), dst->GetRowSize(plane) / sizeof(T), dst->GetHeight(plane), src->GetPitch(plane), dst->GetPitch(plane), stats);
+            }
+            break;
+        case PlaneMode::Copy:
+            copy_plane(dst->GetWritePtr(plane), dst->GetPitch(plane), src->GetReadPtr(plane), src->GetPitch(plane), src->GetRowSize(plane), src->GetHeight(plane));
+            break;
+        case PlaneMode::Leave:
+            break;
+        }
+    }
+    if (temporal_ == 0) {
+        results_.insert(hash, src, dst);
+    }
+    if (stats_) {
+        stats_->record(n, start, false, mask_stats, processed_pixels(src));
+    }
     return dst;
 }
 
-__forceinline void TMaskCleaner::process_pixel(const uint8_t *src, int x, int y, int pitch, int w, int h, std::vector<Coordinates> &coordinates, std::vector<Coordinates> &white_pixels) {
-    coordinates.clear();
-    white_pixels.clear();
-
-    coordinates.emplace_back(x, y);
-
-    while (!coordinates.empty()) {
-        /* pop last coordinates */
-        Coordinates current = coordinates.back();
-        coordinates.pop_back();
-
-        /* check surrounding positions */
-        int x_min = current.first  == 0 ? 0 : current.first - 1;
-        int x_max = current.first  == w - 1 ? w : current.first + 2;
-        int y_min = current.second == 0 ? 0 : current.second - 1;
-        int y_max = current.second == h - 1 ? h : current.second + 2;
-
-        for (int j = y_min; j < y_max; ++j ) {
-            for (int i = x_min; i < x_max; ++i ) {
-                if (!visited(i,j) && is_white(src[j * pitch + i])) {
-                    coordinates.emplace_back(i, j);
-                    white_pixels.emplace_back(i, j);
-                    visit(i,j);
-                }
-            }
+template <typename T>
+size_t TMaskCleaner<T>::processed_pixels(const PVideoFrame &frame) const {
+    size_t pixels = 0;
+    for (int i = 0; i < plane_count_; ++i) {
+        if (plane_modes_[i] == PlaneMode::Process) {
+            pixels += size_t(frame->GetRowSize(plane_ids_[i]) / sizeof(T)) * frame->GetHeight(plane_ids_[i]);
         }
     }
+    return pixels;
 }
 
-void TMaskCleaner::clear_mask(uint8_t *dst, const uint8_t *src, int w, int h, int src_pitch, int dst_pitch) {
-    std::vector<Coordinates> coordinates;
-    std::vector<Coordinates> white_pixels;
+/* planes that are left alone don't affect the result */
+template <typename T>
+uint64_t TMaskCleaner<T>::hash_frame(const PVideoFrame &frame) const {
+    uint64_t hash = 0;
+    for (int i = 0; i < plane_count_; ++i) {
+        if (plane_modes_[i] != PlaneMode::Leave) {
+            int plane = plane_ids_[i];
+            hash = cleaner_.hash_plane(frame->GetReadPtr(plane), frame->GetRowSize(plane) / sizeof(T), frame->GetHeight(plane), frame->GetPitch(plane), hash);
+        }
+    }
+    return hash;
+}
 
-    for(int y = 0; y < h; ++y) {
-        for(int x = 0; x < w; ++x) {
-            if (visited(x,y) || !is_white(src[src_pitch * y + x])) {
-                continue;
+template <typename T>
+bool TMaskCleaner<T>::same_source(const PVideoFrame &a, const PVideoFrame &b) const {
+    for (int i = 0; i < plane_count_; ++i) {
+        int plane = plane_ids_[i];
+        const BYTE *a_ptr = a->GetReadPtr(plane);
+        const BYTE *b_ptr = b->GetReadPtr(plane);
+        if (plane_modes_[i] == PlaneMode::Leave || a_ptr == b_ptr) {
+            continue;
+        }
+        for (int y = 0; y < a->GetHeight(plane); ++y) {
+            if (memcmp(a_ptr + a->GetPitch(plane) * y, b_ptr + b->GetPitch(plane) * y, a->GetRowSize(plane))) {
+                return false;
             }
-            process_pixel(src, x, y, src_pitch, w,h, coordinates, white_pixels);
-            size_t pixels_count = white_pixels.size();
-            if (pixels_count >= length_) {
-                if ((pixels_count - length_ > fade_) || (fade_ == 0)) {
-                    for(auto &pixel: white_pixels) {
-                        dst[dst_pitch * pixel.second + pixel.first] = src[src_pitch * pixel.second + pixel.first];
-                    }
-                } else {
-                    for(auto &pixel: white_pixels) {
-                        dst[dst_pitch * pixel.second + pixel.first] = src[src_pitch * pixel.second + pixel.first] * (pixels_count - length_) / fade_;
-                    }
-                }
+        }
+    }
+    return true;
+}
+
+template <typename T>
+void TMaskCleaner<T>::clear_plane_temporal(PVideoFrame &dst, std::vector<PVideoFrame> &frames, int n, int first, int i, MaskStats *stats, IScriptEnvironment* env) {
+    int plane = plane_ids_[i];
+    const PVideoFrame &src = frames[n - first];
+    int width = src->GetRowSize(plane) / sizeof(T);
+    int height = src->GetHeight(plane);
+
+    std::vector<std::shared_ptr<const ThresholdedPlane>> planes(frames.size());
+    std::vector<const ThresholdedPlane*> neighbours;
+    for (size_t k = 0; k < frames.size(); ++k) {
+        int frame = first + int(k);
+        planes[k] = cleaner_.cached_plane(frame, i);
+        if (!planes[k]) {
+            /* neighbours are only requested once their planes dropped out of the cache */
+            if (!frames[k]) {
+                frames[k] = child->GetFrame(frame, env);
             }
+            planes[k] = cleaner_.threshold_plane(frame, i, frames[k]->GetReadPtr(plane), width, height, frames[k]->GetPitch(plane));
+        }
+        if (frame != n) {
+            neighbours.push_back(planes[k].get());
         }
     }
+    cleaner_.clear_mask_temporal(dst->GetWritePtr(plane), src->GetReadPtr(plane), width, height, src->GetPitch(plane), dst->GetPitch(plane),
+        *planes[n - first], neighbours.data(), int(neighbours.size()), stats);
 }
 
 AVSValue __cdecl create_tmaskcleaner(AVSValue args, void*, IScriptEnvironment* env)
 {
-    enum { CLIP, LENGTH, THRESH, FADE };
-    return new TMaskCleaner(args[CLIP].AsClip(), args[LENGTH].AsInt(5), args[THRESH].AsInt(235), args[FADE].AsInt(0), env);
+    enum { CLIP, LENGTH, THRESH, FADE, THREADS, PLANES, CONNECTIVITY, TEMPORAL, STATS, THRESH_HIGH, LOOKAHEAD, ENGINE, EXPAND, EXPAND_SHAPE };
+    PClip clip = args[CLIP].AsClip();
+    int length = args[LENGTH].AsInt(5);
+    int thresh = args[THRESH].AsInt(235);
+    int thresh_high = args[THRESH_HIGH].AsInt(thresh);
+    int fade = args[FADE].AsInt(0);
+    int threads = args[THREADS].AsInt(1);
+    const char *planes = args[PLANES].AsString("311");
+    int connectivity = args[CONNECTIVITY].AsInt(8);
+    int temporal = args[TEMPORAL].AsInt(0);
+    const char *stats = args[STATS].AsString("");
+    int lookahead = args[LOOKAHEAD].AsInt(0);
+    Engine engine;
+    int expand = args[EXPAND].AsInt(0);
+    ExpandShape expand_shape;
+
+    const char *error = check_parameters(length, thresh, thresh_high, fade, connectivity, temporal, threads, expand);
+    if (error) {
+        env->ThrowError(error);
+    }
+    if (lookahead < 0) {
+        env->ThrowError("TMaskCleaner: lookahead cannot be negative.");
+    }
+    if (!parse_engine(args[ENGINE].AsString("unionfind"), engine)) {
+        env->ThrowError("TMaskCleaner: engine must be auto, floodfill, unionfind or runs.");
+    }
+    if (!parse_expand_shape(args[EXPAND_SHAPE].AsString("square"), expand_shape)) {
+        env->ThrowError("TMaskCleaner: expand_shape must be square or diamond.");
+    }
+
+    int bits = bits_per_sample(clip->GetVideoInfo());
+    switch (bits) {
+    case 8:
+        return new TMaskCleaner<uint8_t>(clip, length, thresh, thresh_high, fade, connectivity, temporal, threads, bits, planes, stats, lookahead, engine, expand, expand_shape, env);
+    case 10:
+    case 12:
+    case 14:
+    case 16:
+        return new TMaskCleaner<uint16_t>(clip, length, thresh, thresh_high, fade, connectivity, temporal, threads, bits, planes, stats, lookahead, engine, expand, expand_shape, env);
+    case 32:
+        return new TMaskCleaner<float>(clip, length, thresh, thresh_high, fade, connectivity, temporal, threads, bits, planes, stats, lookahead, engine, expand, expand_shape, env);
+    default:
+        env->ThrowError("TMaskCleaner: unsupported bit depth.");
+        return AVSValue();
+    }
 }
 
 const AVS_Linkage *AVS_linkage = nullptr;
 
-extern "C" __declspec(dllexport) const char* __stdcall AvisynthPluginInit3(IScriptEnvironment* env, const AVS_Linkage* const vectors) {
+extern "C" PLUGIN_EXPORT const char* __stdcall AvisynthPluginInit3(IScriptEnvironment* env, const AVS_Linkage* const vectors) {
     AVS_linkage = vectors;
 
-    env->AddFunction("TMaskCleaner", "c[length]i[thresh]i[fade]i", create_tmaskcleaner, 0);
+    env->AddFunction("TMaskCleaner", "c[length]i[thresh]i[fade]i[threads]i[planes]s[connectivity]i[temporal]i[stats]s[thresh_high]i[lookahead]i[engine]s[expand]i[expand_shape]s", create_tmaskcleaner, 0);
     return "Why are you looking at this?";
 }
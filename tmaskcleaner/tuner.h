@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+/* the engines Auto chooses from come first */
+enum class Engine {
+    FloodFill,
+    UnionFind,
+    Runs,
+    /* times the others on the first planes and keeps the fastest */
+    Auto
+};
+
+/* Picks the engine for Engine::Auto. The first planes are handed out round robin to every engine,
+   and once all trials are back the one with the least time per pixel is used for the rest of the
+   clip. The first trial of each engine also grows the workspace for it and isn't counted. Engines
+   give identical masks, so trials only cost time. Planes cleaned concurrently are timed as they
+   are, which favours engines that hold up under the load the filter actually runs with. */
+class EngineTuner {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    EngineTuner() : handed_out_(0), reported_(0), chosen_(Engine::Auto) {
+        for (int i = 0; i < candidate_count; ++i) {
+            samples_[i] = 0;
+            seconds_[i] = 0;
+            pixels_[i] = 0;
+        }
+    }
+
+    /* engine for the next plane, trial is set if its time has to be reported */
+    Engine pick(bool &trial) {
+        trial = false;
+        Engine chosen = chosen_.load();
+        if (chosen != Engine::Auto) {
+            return chosen;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        /* planes cleaned while the last trials are still running take the default engine */
+        if (handed_out_ == candidate_count * (warmup_trials + trials_per_engine)) {
+            return Engine::UnionFind;
+        }
+        trial = true;
+        return Engine(handed_out_++ % candidate_count);
+    }
+
+    void report(Engine engine, Clock::time_point start, size_t pixels) {
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(mutex_);
+        int i = int(engine);
+        if (++samples_[i] > warmup_trials) {
+            seconds_[i] += seconds;
+            pixels_[i] += pixels;
+        }
+        if (++reported_ < candidate_count * (warmup_trials + trials_per_engine)) {
+            return;
+        }
+        int best = 0;
+        for (int k = 1; k < candidate_count; ++k) {
+            if (seconds_[k] * pixels_[best] < seconds_[best] * pixels_[k]) {
+                best = k;
+            }
+        }
+        chosen_.store(Engine(best));
+    }
+
+    /* the engine the trials settled on, Engine::Auto while they are running */
+    Engine chosen() const {
+        return chosen_.load();
+    }
+
+private:
+    static const int candidate_count = 3;
+    static const int trials_per_engine = 4;
+    static const int warmup_trials = 1;
+
+    int handed_out_;
+    int reported_;
+    int samples_[candidate_count];
+    double seconds_[candidate_count];
+    double pixels_[candidate_count];
+    std::atomic<Engine> chosen_;
+    std::mutex mutex_;
+
+    EngineTuner(const EngineTuner&);
+    EngineTuner &operator=(const EngineTuner&);
+};
@@ -0,0 +1,354 @@
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <VapourSynth4.h>
+#include "cleaner.h"
+#include "result_cache.h"
+
+/* frame reference that can be stored in a ResultCache */
+class FrameRef {
+public:
+    FrameRef(const VSFrame *frame, const VSAPI *vsapi) : frame_(vsapi->addFrameRef(frame)), vsapi_(vsapi) {}
+    FrameRef(const FrameRef &other) : frame_(other.vsapi_->addFrameRef(other.frame_)), vsapi_(other.vsapi_) {}
+    ~FrameRef() {
+        vsapi_->freeFrame(frame_);
+    }
+
+    FrameRef &operator=(const FrameRef &other) {
+        const VSFrame *frame = other.vsapi_->addFrameRef(other.frame_);
+        vsapi_->freeFrame(frame_);
+        frame_ = frame;
+        vsapi_ = other.vsapi_;
+        return *this;
+    }
+
+    const VSFrame *get() const {
+        return frame_;
+    }
+
+private:
+    const VSFrame *frame_;
+    const VSAPI *vsapi_;
+};
+
+template <typename T>
+struct TMaskCleanerData {
+    TMaskCleanerData(VSNode *node, const VSVideoInfo *vi, int length, int thresh, int thresh_high, int fade, int connectivity, int temporal, int threads, Engine engine, int expand, ExpandShape expand_shape)
+        : node(node), vi(vi), temporal(temporal), cleaner(vi->width, vi->height, length, thresh, thresh_high, fade, connectivity, temporal, threads, vi->format.bitsPerSample, cpu_features(), engine, expand, expand_shape),
+          results(result_cache_size) {
+    }
+
+    VSNode *node;
+    const VSVideoInfo *vi;
+    bool process[3];
+    int temporal;
+    Cleaner<T> cleaner;
+    /* results of identical source frames are shared, but not in temporal mode where the neighbours count too */
+    ResultCache<FrameRef> results;
+    /* only created with the stats parameter */
+    std::unique_ptr<StatsLog> stats;
+    /* planes of it are shared by every plane that ends up empty */
+    std::unique_ptr<FrameRef> black;
+};
+
+template <typename T>
+static size_t processed_pixels(TMaskCleanerData<T> *d, const VSFrame *frame, const VSAPI *vsapi) {
+    size_t pixels = 0;
+    for (int plane = 0; plane < d->vi->format.numPlanes; ++plane) {
+        if (d->process[plane]) {
+            pixels += size_t(vsapi->getFrameWidth(frame, plane)) * vsapi->getFrameHeight(frame, plane);
+        }
+    }
+    return pixels;
+}
+
+template <typename T>
+static uint64_t hash_frame(TMaskCleanerData<T> *d, const VSFrame *frame, const VSAPI *vsapi) {
+    uint64_t hash = 0;
+    for (int plane = 0; plane < d->vi->format.numPlanes; ++plane) {
+        if (!d->process[plane]) {
+            continue;
+        }
+        hash = d->cleaner.hash_plane(vsapi->getReadPtr(frame, plane), vsapi->getFrameWidth(frame, plane), vsapi->getFrameHeight(frame, plane),
+            int(vsapi->getStride(frame, plane)), hash);
+    }
+    return hash;
+}
+
+template <typename T>
+static bool same_source(TMaskCleanerData<T> *d, const VSFrame *a, const VSFrame *b, const VSAPI *vsapi) {
+    for (int plane = 0; plane < d->vi->format.numPlanes; ++plane) {
+        const uint8_t *a_ptr = vsapi->getReadPtr(a, plane);
+        const uint8_t *b_ptr = vsapi->getReadPtr(b, plane);
+        if (!d->process[plane] || a_ptr == b_ptr) {
+            continue;
+        }
+        size_t row_size = vsapi->getFrameWidth(a, plane) * sizeof(T);
+        for (int y = 0; y < vsapi->getFrameHeight(a, plane); ++y) {
+            if (memcmp(a_ptr + vsapi->getStride(a, plane) * y, b_ptr + vsapi->getStride(b, plane) * y, row_size)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* neighbours were all requested, but only the ones that dropped out of the cache are thresholded again */
+template <typename T>
+static void clear_plane_temporal(TMaskCleanerData<T> *d, VSFrame *dst, const VSFrame *src, int n, int plane, MaskStats *stats, VSFrameContext *frame_ctx, const VSAPI *vsapi) {
+    int width = vsapi->getFrameWidth(src, plane);
+    int height = vsapi->getFrameHeight(src, plane);
+    int first = std::max(n - d->temporal, 0);
+    int last = std::min(n + d->temporal, d->vi->numFrames - 1);
+
+    std::vector<std::shared_ptr<const ThresholdedPlane>> planes;
+    std::vector<const ThresholdedPlane*> neighbours;
+    const ThresholdedPlane *current = nullptr;
+    for (int k = first; k <= last; ++k) {
+        std::shared_ptr<const ThresholdedPlane> thresholded = d->cleaner.cached_plane(k, plane);
+        if (!thresholded) {
+            const VSFrame *frame = vsapi->getFrameFilter(k, d->node, frame_ctx);
+            thresholded = d->cleaner.threshold_plane(k, plane, vsapi->getReadPtr(frame, plane), width, height, int(vsapi->getStride(frame, plane)));
+            vsapi->freeFrame(frame);
+        }
+        if (k == n) {
+            current = thresholded.get();
+        } else {
+            neighbours.push_back(thresholded.get());
+        }
+        planes.push_back(thresholded);
+    }
+    d->cleaner.clear_mask_temporal(vsapi->getWritePtr(dst, plane), vsapi->getReadPtr(src, plane), width, height,
+        int(vsapi->getStride(src, plane)), int(vsapi->getStride(dst, plane)), *current, neighbours.data(), int(neighbours.size()), stats);
+}
+
+template <typename T>
+static const VSFrame *VS_CC tmaskcleaner_get_frame(int n, int activation_reason, void *instance_data, void **, VSFrameContext *frame_ctx, VSCore *core, const VSAPI *vsapi) {
+    TMaskCleanerData<T> *d = static_cast<TMaskCleanerData<T>*>(instance_data);
+
+    if (activation_reason == arInitial) {
+        for (int k = std::max(n - d->temporal, 0); k <= std::min(n + d->temporal, d->vi->numFrames - 1); ++k) {
+            vsapi->requestFrameFilter(k, d->node, frame_ctx);
+        }
+    } else if (activation_reason == arAllFramesReady) {
+        const VSFrame *src = vsapi->getFrameFilter(n, d->node, frame_ctx);
+        const VSVideoFormat *fi = vsapi->getVideoFrameFormat(src);
+        StatsLog::Clock::time_point start;
+        MaskStats mask_stats = MaskStats();
+        MaskStats *stats = nullptr;
+        if (d->stats) {
+            start = StatsLog::Clock::now();
+            stats = &mask_stats;
+        }
+
+        /* planes that are empty or a single copied component are shared instead of labeled */
+        PlaneResult results[3];
+        bool all_source = true;
+        bool mixed = false;
+        for (int plane = 0; plane < fi->numPlanes; ++plane) {
+            if (d->process[plane]) {
+                int width = vsapi->getFrameWidth(src, plane);
+                int height = vsapi->getFrameHeight(src, plane);
+                results[plane] = d->cleaner.classify_plane(vsapi->getReadPtr(src, plane), width, height, int(vsapi->getStride(src, plane)), stats);
+                if (results[plane] == PlaneResult::Black && d->temporal > 0) {
+                    d->cleaner.cache_black_plane(n, plane, width, height);
+                }
+                all_source = all_source && results[plane] == PlaneResult::Source;
+                mixed = mixed || results[plane] == PlaneResult::Mixed;
+            }
+        }
+        if (all_source) {
+            if (d->stats) {
+                d->stats->record(n, start, false, mask_stats, processed_pixels(d, src, vsapi));
+            }
+            return src;
+        }
+
+        /* the processed planes of an identical earlier source are reused, the frame properties still come from src */
+        uint64_t hash = 0;
+        const VSFrame *done = nullptr;
+        std::vector<ResultCache<FrameRef>::Entry> candidates;
+        if (d->temporal == 0 && mixed) {
+            hash = hash_frame(d, src, vsapi);
+            candidates = d->results.find(hash);
+            for (size_t i = 0; i < candidates.size() && !done; ++i) {
+                if (same_source(d, candidates[i].src.get(), src, vsapi)) {
+                    done = candidates[i].dst.get();
+                }
+            }
+        }
+
+        /* planes that aren't processed are shared with the source frame instead of copied */
+        const VSFrame *plane_src[3];
+        int planes[3] = { 0, 1, 2 };
+        for (int plane = 0; plane < fi->numPlanes; ++plane) {
+            if (!d->process[plane] || (!done && results[plane] == PlaneResult::Source)) {
+                plane_src[plane] = src;
+            } else if (!done && results[plane] == PlaneResult::Black) {
+                plane_src[plane] = d->black->get();
+            } else {
+                plane_src[plane] = done;
+            }
+        }
+        VSFrame *dst = vsapi->newVideoFrame2(fi, vsapi->getFrameWidth(src, 0), vsapi->getFrameHeight(src, 0), plane_src, planes, src, core);
+        if (done || !mixed) {
+            if (d->stats) {
+                d->stats->record(n, start, done != nullptr, done ? MaskStats() : mask_stats, processed_pixels(d, src, vsapi));
+            }
+            vsapi->freeFrame(src);
+            return dst;
+        }
+
+        for (int plane = 0; plane < fi->numPlanes; ++plane) {
+            if (!d->process[plane] || results[plane] != PlaneResult::Mixed) {
+                continue;
+            }
+            if (d->temporal > 0) {
+                clear_plane_temporal(d, dst, src, n, plane, stats, frame_ctx, vsapi);
+            } else {
+                d->cleaner.clear_mask(vsapi->getWritePtr(dst, plane), vsapi->getReadPtr(src, plane), vsapi->getFrameWidth(src, plane), vsapi->getFrameHeight(src, plane),
+                    int(vsapi->getStride(src, plane)), int(vsapi->getStride(dst, plane)), stats);
+            }
+        }
+        if (d->temporal == 0) {
+            d->results.insert(hash, FrameRef(src, vsapi), FrameRef(dst, vsapi));
+        }
+        if (d->stats) {
+            d->stats->record(n, start, false, mask_stats, processed_pixels(d, src, vsapi));
+        }
+        vsapi->freeFrame(src);
+        return dst;
+    }
+    return nullptr;
+}
+
+template <typename T>
+static void VS_CC tmaskcleaner_free(void *instance_data, VSCore *, const VSAPI *vsapi) {
+    TMaskCleanerData<T> *d = static_cast<TMaskCleanerData<T>*>(instance_data);
+    vsapi->freeNode(d->node);
+    delete d;
+}
+
+template <typename T>
+static void create_filter(const VSMap *in, VSMap *out, VSNode *node, const VSVideoInfo *vi, int length, int thresh, int thresh_high, int fade, int connectivity, int temporal, int threads, Engine engine, int expand, ExpandShape expand_shape, VSCore *core, const VSAPI *vsapi) {
+    TMaskCleanerData<T> *d = new TMaskCleanerData<T>(node, vi, length, thresh, thresh_high, fade, connectivity, temporal, threads, engine, expand, expand_shape);
+
+    /* like most VapourSynth filters only the listed planes are processed, the rest is copied */
+    int err;
+    int planes_count = vsapi->mapNumElements(in, "planes");
+    for (int plane = 0; plane < 3; ++plane) {
+        d->process[plane] = planes_count <= 0 && plane == 0;
+    }
+    for (int i = 0; i < planes_count; ++i) {
+        int plane = int(vsapi->mapGetInt(in, "planes", i, nullptr));
+        if (plane < 0 || plane >= vi->format.numPlanes) {
+            vsapi->mapSetError(out, "TMaskCleaner: plane index out of range.");
+            vsapi->freeNode(node);
+            delete d;
+            return;
+        }
+        d->process[plane] = true;
+    }
+
+    const char *stats = vsapi->mapGetData(in, "stats", 0, &err);
+    if (!err && *stats) {
+        d->stats.reset(new StatsLog(stats));
+        if (!d->stats->is_open()) {
+            vsapi->mapSetError(out, "TMaskCleaner: can't open the stats file.");
+            vsapi->freeNode(node);
+            delete d;
+            return;
+        }
+    }
+
+    VSFrame *black = vsapi->newVideoFrame(&vi->format, vi->width, vi->height, nullptr, core);
+    for (int plane = 0; plane < vi->format.numPlanes; ++plane) {
+        memset(vsapi->getWritePtr(black, plane), 0, vsapi->getStride(black, plane) * vsapi->getFrameHeight(black, plane));
+    }
+    d->black.reset(new FrameRef(black, vsapi));
+    vsapi->freeFrame(black);
+
+    VSFilterDependency deps[] = { { node, temporal > 0 ? rpGeneral : rpStrictSpatial } };
+    vsapi->createVideoFilter(out, "TMaskCleaner", vi, tmaskcleaner_get_frame<T>, tmaskcleaner_free<T>, fmParallel, deps, 1, d, core);
+}
+
+static void VS_CC create_tmaskcleaner(const VSMap *in, VSMap *out, void *, VSCore *core, const VSAPI *vsapi) {
+    int err;
+    int length = vsapi->mapGetIntSaturated(in, "length", 0, &err);
+    if (err) {
+        length = 5;
+    }
+    int thresh = vsapi->mapGetIntSaturated(in, "thresh", 0, &err);
+    if (err) {
+        thresh = 235;
+    }
+    /* equal thresholds disable hysteresis */
+    int thresh_high = vsapi->mapGetIntSaturated(in, "thresh_high", 0, &err);
+    if (err) {
+        thresh_high = thresh;
+    }
+    int fade = vsapi->mapGetIntSaturated(in, "fade", 0, &err);
+    if (err) {
+        fade = 0;
+    }
+    int threads = vsapi->mapGetIntSaturated(in, "threads", 0, &err);
+    if (err) {
+        threads = 1;
+    }
+    int connectivity = vsapi->mapGetIntSaturated(in, "connectivity", 0, &err);
+    if (err) {
+        connectivity = 8;
+    }
+    int temporal = vsapi->mapGetIntSaturated(in, "temporal", 0, &err);
+    if (err) {
+        temporal = 0;
+    }
+    const char *engine_arg = vsapi->mapGetData(in, "engine", 0, &err);
+    Engine engine = Engine::UnionFind;
+    if (!err && !parse_engine(engine_arg, engine)) {
+        vsapi->mapSetError(out, "TMaskCleaner: engine must be auto, floodfill, unionfind or runs.");
+        return;
+    }
+    int expand = vsapi->mapGetIntSaturated(in, "expand", 0, &err);
+    if (err) {
+        expand = 0;
+    }
+    const char *expand_shape_arg = vsapi->mapGetData(in, "expand_shape", 0, &err);
+    ExpandShape expand_shape = ExpandShape::Square;
+    if (!err && !parse_expand_shape(expand_shape_arg, expand_shape)) {
+        vsapi->mapSetError(out, "TMaskCleaner: expand_shape must be square or diamond.");
+        return;
+    }
+
+    const char *error = check_parameters(length, thresh, thresh_high, fade, connectivity, temporal, threads, expand);
+    if (error) {
+        vsapi->mapSetError(out, error);
+        return;
+    }
+
+    VSNode *node = vsapi->mapGetNode(in, "clip", 0, nullptr);
+    const VSVideoInfo *vi = vsapi->getVideoInfo(node);
+    const VSVideoFormat &format = vi->format;
+
+    if (format.colorFamily == cfUndefined || vi->width == 0 || vi->height == 0) {
+        vsapi->mapSetError(out, "TMaskCleaner: only constant format input is supported.");
+        vsapi->freeNode(node);
+    } else if (format.sampleType == stInteger && format.bitsPerSample == 8) {
+        create_filter<uint8_t>(in, out, node, vi, length, thresh, thresh_high, fade, connectivity, temporal, threads, engine, expand, expand_shape, core, vsapi);
+    } else if (format.sampleType == stInteger && format.bitsPerSample <= 16) {
+        create_filter<uint16_t>(in, out, node, vi, length, thresh, thresh_high, fade, connectivity, temporal, threads, engine, expand, expand_shape, core, vsapi);
+    } else if (format.sampleType == stFloat && format.bitsPerSample == 32) {
+        create_filter<float>(in, out, node, vi, length, thresh, thresh_high, fade, connectivity, temporal, threads, engine, expand, expand_shape, core, vsapi);
+    } else {
+        vsapi->mapSetError(out, "TMaskCleaner: unsupported bit depth.");
+        vsapi->freeNode(node);
+    }
+}
+
+VS_EXTERNAL_API(void) VapourSynthPluginInit2(VSPlugin *plugin, const VSPLUGINAPI *vspapi) {
+    vspapi->configPlugin("com.tp7.tmaskcleaner", "tmc", "A really simple mask cleaning plugin", VS_MAKE_VERSION(1, 0), VAPOURSYNTH_API_VERSION, 0, plugin);
+    vspapi->registerFunction("TMaskCleaner",
+        "clip:vnode;length:int:opt;thresh:int:opt;thresh_high:int:opt;fade:int:opt;threads:int:opt;planes:int[]:opt;connectivity:int:opt;temporal:int:opt;stats:data:opt;engine:data:opt;expand:int:opt;expand_shape:data:opt;",
+        "clip:vnode;", create_tmaskcleaner, nullptr, plugin);
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "bitmap.h"
+
+/* horizontal span [start, end) of white pixels */
+struct Run {
+    int start;
+    int end;
+    uint32_t label;
+};
+
+template <typename T>
+static inline size_t capacity_bytes(const std::vector<T> &v) {
+    return v.capacity() * sizeof(T);
+}
+
+/* scans can't create more provisional labels than that, +1 for the background: every other pixel
+   of every other row with 8-connectivity, a checkerboard with 4-connectivity */
+static inline size_t max_labels(int width, int height, int connectivity) {
+    if (connectivity == 4) {
+        return (size_t(width) * height + 1) / 2 + 1;
+    }
+    return size_t((width + 1) / 2) * ((height + 1) / 2) + 1;
+}
+
+/* Scratch state of a single clear_mask call. Buffers are sized for the largest plane of the
+   clip; the ones that only a single engine needs are allocated by that engine on first use. */
+struct Workspace {
+    Workspace(int width, int height)
+        : width(width), height(height), bitmap_stride(::bitmap_stride(width)), white(size_t(bitmap_stride) * height) {
+    }
+
+    int width;
+    int height;
+    /* words per bitmap row and words before the first one, set for the plane being processed */
+    int bitmap_stride;
+    int bitmap_offset;
+
+    /* white pixels and white pixels of components copied unfaded, counted while deciding factors */
+    size_t white_count;
+    size_t kept_count;
+    /* only reported in MaskStats */
+    size_t component_count;
+    size_t largest_component;
+    size_t removed_count;
+    size_t peak_queue;
+
+    std::vector<uint64_t> white;
+    /* hysteresis state: pixels reaching thresh_high, same layout as white, and the root labels containing one */
+    std::vector<uint64_t> seeds;
+    std::vector<uint8_t> seeded;
+
+    /* flood fill state: white_pixels holds pixels of the current component as bit indexes into the
+       padded white and doubles as the fill queue; the fill clears the bits of white it reaches */
+    std::vector<uint32_t> white_pixels;
+
+    /* union-find state: labels has a one-pixel zero border on the left, right and top */
+    std::vector<uint32_t> labels;
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> areas;
+
+    /* parallel union-find state: labels of stripe s are [stripe_labels[s], stripe_ends[s]) */
+    std::vector<uint32_t> stripe_labels;
+    std::vector<uint32_t> stripe_ends;
+
+    /* run-length state: runs of row y are [row_runs[y], row_runs[y + 1]) */
+    std::vector<Run> runs;
+    std::vector<size_t> row_runs;
+
+    /* temporal state: number of neighbouring frames overlapped by each root label */
+    std::vector<uint32_t> hits;
+
+    /* expand state: a ring of output rows dilated horizontally, by expand for the square and by
+       every radius up to expand for the diamond, and whether the row had anything to dilate */
+    std::vector<uint8_t> expand_rows;
+    std::vector<uint8_t> expand_nonzero;
+
+    /* bytes held by all buffers; they never shrink, so this is also the peak */
+    size_t memory() const {
+        return capacity_bytes(white) + capacity_bytes(white_pixels)
+            + capacity_bytes(labels) + capacity_bytes(parents) + capacity_bytes(areas)
+            + capacity_bytes(stripe_labels) + capacity_bytes(stripe_ends) + capacity_bytes(runs) + capacity_bytes(row_runs) + capacity_bytes(hits)
+            + capacity_bytes(seeds) + capacity_bytes(seeded) + capacity_bytes(expand_rows) + capacity_bytes(expand_nonzero);
+    }
+
+    void reset_counts() {
+        white_count = 0;
+        kept_count = 0;
+        component_count = 0;
+        largest_component = 0;
+        removed_count = 0;
+        peak_queue = 0;
+    }
+
+    void reserve_labels(size_t count) {
+        if (parents.size() < count) {
+            parents.resize(count);
+            areas.resize(count);
+        }
+    }
+
+    uint32_t find_root(uint32_t label) {
+        while (parents[label] != label) {
+            parents[label] = parents[parents[label]];
+            label = parents[label];
+        }
+        return label;
+    }
+
+    uint32_t merge(uint32_t a, uint32_t b) {
+        a = find_root(a);
+        b = find_root(b);
+        if (a < b) {
+            parents[b] = a;
+            return a;
+        }
+        parents[a] = b;
+        return b;
+    }
+
+    /* Lays white and seeds out for the flood fill: a zero word and a zero row before the plane, a
+       zero row after it and at least one zero bit at the end of every row. Every neighbour of a
+       pixel is then a fixed bit offset away, and the ones outside the plane read as black. */
+    void pad_bitmaps(int width, int height, bool hysteresis) {
+        bitmap_stride = ::bitmap_stride(width + 1);
+        bitmap_offset = bitmap_stride + 1;
+        size_t size = bitmap_offset + size_t(bitmap_stride) * (height + 1);
+        /* resize alone would double the capacity */
+        if (white.size() < size) {
+            white.reserve(size);
+            white.resize(size);
+        }
+        if (hysteresis && seeds.size() < size) {
+            seeds.reserve(size);
+            seeds.resize(size);
+        }
+        std::fill(white.begin(), white.begin() + bitmap_offset, 0);
+        std::fill_n(white.begin() + bitmap_offset + size_t(bitmap_stride) * height, bitmap_stride, 0);
+        /* thresholding only writes the words holding pixels */
+        if (bitmap_stride > ::bitmap_stride(width)) {
+            for (int y = 0; y < height; ++y) {
+                white[bitmap_offset + size_t(bitmap_stride) * y + bitmap_stride - 1] = 0;
+            }
+        }
+    }
+
+    bool is_seed(uint32_t bit) const {
+        return (seeds[bit / 64] >> (bit % 64)) & 1;
+    }
+
+    /* takes a white pixel out of white, so every pixel is queued once */
+    void consume(uint32_t bit) {
+        white[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+    }
+
+    /* queues a neighbour of the flood fill if it's still white */
+    void fill(uint32_t bit) {
+        uint64_t &word = white[bit / 64];
+        uint64_t mask = uint64_t(1) << (bit % 64);
+        if (word & mask) {
+            word &= ~mask;
+            white_pixels.push_back(bit);
+        }
+    }
+};
+
+/* Workspaces are checked out for the duration of a GetFrame call, so concurrent calls never
+   share scratch memory and the pool grows to the number of threads actually used. */
+class WorkspacePool {
+public:
+    WorkspacePool(int width, int height) : width_(width), height_(height) {}
+
+    std::unique_ptr<Workspace> acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            return std::unique_ptr<Workspace>(new Workspace(width_, height_));
+        }
+        std::unique_ptr<Workspace> workspace = std::move(free_.back());
+        free_.pop_back();
+        return workspace;
+    }
+
+    void release(std::unique_ptr<Workspace> workspace) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(std::move(workspace));
+    }
+
+    /* scratch memory of the workspaces that aren't checked out */
+    size_t memory() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t bytes = 0;
+        for (auto &workspace : free_) {
+            bytes += workspace->memory();
+        }
+        return bytes;
+    }
+
+private:
+    int width_;
+    int height_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Workspace>> free_;
+};